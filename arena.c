@@ -0,0 +1,161 @@
+/*
+arena.c
+
+Per-thread bump allocator for scratch buffers that only live as long as one
+chunk is being decoded or encoded.  Allocation is a pointer bump, and nothing
+is freed individually: callers take a mark before their scratch work and
+release back to it afterwards, so nested users (a chunk being saved while
+another is loaded) each get their memory back in order.
+
+When everything is released, any overflow blocks are merged into one block big
+enough for the high-water mark, so after the first few chunks a thread's
+arena is a single block and the load/save loop does no allocation at all.
+*/
+
+#include <Python.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minecraft.h"
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *previous; // Older, smaller blocks in use
+    size_t size, used;
+    unsigned char data[] __attribute__((aligned(ARENA_ALIGNMENT)));
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *current;
+    size_t base;    // Bytes used in all the blocks before current
+    size_t highest; // High-water mark since the arena was last empty
+} Arena;
+
+static __thread Arena arena;
+
+static ArenaBlock *new_block( size_t size, ArenaBlock *previous )
+{
+    ArenaBlock *block;
+
+    block = malloc(sizeof(ArenaBlock) + size);
+    if( block == NULL )
+        return NULL;
+
+    block->previous = previous;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+/*
+Returns size bytes of uninitialised scratch memory, aligned to ARENA_ALIGNMENT,
+which stays valid until the arena is released back past this point.  Returns
+NULL if memory runs out.
+*/
+void *arena_alloc( size_t size )
+{
+    ArenaBlock *block;
+    void *memory;
+
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+
+    block = arena.current;
+    if( block == NULL || block->used + size > block->size )
+    {
+        size_t block_size;
+
+        // Grow geometrically, so a chunk bigger than usual costs few blocks
+        block_size = block == NULL ? ARENA_BLOCK_SIZE : block->size * 2;
+        if( block_size < size )
+            block_size = size;
+
+        if( block != NULL )
+            arena.base += block->used;
+        block = new_block(block_size, block);
+        if( block == NULL )
+            return NULL;
+        arena.current = block;
+    }
+
+    memory = block->data + block->used;
+    block->used += size;
+    if( arena.base + block->used > arena.highest )
+        arena.highest = arena.base + block->used;
+
+    return memory;
+}
+
+// As arena_alloc, but zeroed
+void *arena_calloc( size_t size )
+{
+    void *memory;
+
+    memory = arena_alloc(size);
+    if( memory != NULL )
+        memset(memory, 0, size);
+    return memory;
+}
+
+// Position to release back to once the scratch work that follows is done
+size_t arena_mark( void )
+{
+    return arena.current == NULL ? 0 : arena.base + arena.current->used;
+}
+
+/*
+Frees everything allocated since mark was taken.  Releasing to 0 empties the
+arena, and is when overflow blocks are merged.
+*/
+void arena_release( size_t mark )
+{
+    ArenaBlock *block;
+
+    block = arena.current;
+    if( block == NULL )
+        return;
+
+    // Still within the current block
+    if( mark >= arena.base )
+    {
+        block->used = mark - arena.base;
+        return;
+    }
+
+    // Back in an older block, so the newer ones can go
+    if( mark != 0 )
+    {
+        while( block->previous != NULL && mark < arena.base )
+        {
+            ArenaBlock *previous;
+
+            previous = block->previous;
+            arena.base -= previous->used;
+            free(block);
+            block = previous;
+        }
+        arena.current = block;
+        block->used = mark - arena.base;
+        return;
+    }
+
+    // Empty: keep one block that fits everything used since last time
+    if( block->previous != NULL )
+    {
+        size_t size;
+
+        size = block->size > arena.highest ? block->size : arena.highest;
+        while( block != NULL )
+        {
+            ArenaBlock *previous;
+
+            previous = block->previous;
+            free(block);
+            block = previous;
+        }
+        block = new_block(size, NULL);
+        arena.current = block;
+    }
+    if( block != NULL )
+        block->used = 0;
+    arena.base = 0;
+    arena.highest = 0;
+}
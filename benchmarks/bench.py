@@ -0,0 +1,323 @@
+"""
+bench.py
+
+Benchmarks for the load, edit and save paths of the minecraft module, run
+against a synthetic world written from scratch, so no real save is needed.
+Build the module in place first (python setup.py build_ext --inplace), then:
+
+    python benchmarks/bench.py [-o results.json] [--repeat N] [--world DIR]
+
+Every benchmark is run several times and the best time kept, with the
+module's logging at LOG_WARNING.  Results are written as JSON, along with the
+commit they were taken at, so that two runs can be compared with
+--compare old.json.
+"""
+
+import gzip
+import json
+import optparse
+import os
+import random
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import zlib
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, ROOT)
+
+import minecraft
+
+"""
+
+Synthetic world
+
+"""
+def tag_header(tag_id, name):
+    return struct.pack('>bh', tag_id, len(name)) + name
+
+def compound(items):
+    return ''.join(items) + '\x00'
+
+def byte_array(name, data):
+    return tag_header(7, name) + struct.pack('>i', len(data)) + data
+
+def int_array(name, values):
+    return tag_header(11, name) + struct.pack('>i', len(values)) + struct.pack('>%di' % len(values), *values)
+
+# A chunk of layered terrain: stone, dirt and grass up to a random-ish height,
+# with ores scattered through the stone
+def chunk_nbt(cx, cz, rnd, sections):
+    items = []
+    for y in range(sections):
+        blocks = bytearray(4096)
+        for i in range(4096):
+            height = y * 16 + (i >> 8)
+            if height < 40:
+                blocks[i] = 1 if rnd.random() > 0.02 else rnd.choice((14, 15, 16, 56))
+            elif height < 44:
+                blocks[i] = 3
+            elif height == 44:
+                blocks[i] = 2
+        items.append(compound([
+            tag_header(1, 'Y') + struct.pack('>b', y),
+            byte_array('Blocks', str(blocks)),
+            byte_array('Data', '\x00' * 2048),
+            byte_array('BlockLight', '\x00' * 2048),
+            byte_array('SkyLight', '\xff' * 2048)]))
+
+    level = compound([
+        tag_header(3, 'xPos') + struct.pack('>i', cx),
+        tag_header(3, 'zPos') + struct.pack('>i', cz),
+        tag_header(4, 'LastUpdate') + struct.pack('>q', 0),
+        tag_header(1, 'TerrainPopulated') + '\x01',
+        byte_array('Biomes', '\x01' * 256),
+        int_array('HeightMap', [45] * 256),
+        tag_header(9, 'Sections') + struct.pack('>bi', 10, len(items)) + ''.join(items),
+        tag_header(9, 'Entities') + struct.pack('>bi', 1, 0),
+        tag_header(9, 'TileEntities') + struct.pack('>bi', 1, 0)])
+    return tag_header(10, '') + compound([tag_header(10, 'Level') + level])
+
+def region_file(rx, rz, rnd, chunks, sections):
+    header = bytearray(8192)
+    body = []
+    sector = 2
+    for i in range(chunks):
+        cx, cz = rx * 32 + i % 32, rz * 32 + i // 32
+        data = zlib.compress(chunk_nbt(cx, cz, rnd, sections))
+        payload = struct.pack('>ib', len(data) + 1, 2) + data
+        count = (len(payload) + 4095) // 4096
+        payload += '\x00' * (count * 4096 - len(payload))
+        struct.pack_into('>I', header, 4 * i, (sector << 8) | count)
+        body.append(payload)
+        sector += count
+    return str(header) + ''.join(body)
+
+def make_world(path, regions=2, chunks=256, sections=4, seed=1):
+    """Write a world of the given number of regions along X, each holding
+    chunks chunks of sections sections, with a fixed seed."""
+    rnd = random.Random(seed)
+    os.makedirs(os.path.join(path, 'region'))
+
+    level = compound([tag_header(10, 'Data') + compound([
+        tag_header(3, 'version') + struct.pack('>i', 19133),
+        tag_header(8, 'LevelName') + struct.pack('>h', 5) + 'bench'])])
+    f = gzip.open(os.path.join(path, 'level.dat'), 'wb')
+    f.write(tag_header(10, '') + level)
+    f.close()
+
+    for rx in range(regions):
+        f = open(os.path.join(path, 'region', 'r.%d.0.mca' % rx), 'wb')
+        f.write(region_file(rx, 0, rnd, chunks, sections))
+        f.close()
+
+"""
+
+Benchmarks
+
+Each takes the path of a fresh copy of the world and returns the number of
+operations it timed; the harness does the timing around it.
+
+"""
+BENCHMARKS = []
+
+def benchmark(function):
+    BENCHMARKS.append(function)
+    return function
+
+def chunk_coordinates(count):
+    return [(i % 32, i // 32) for i in range(count)]
+
+@benchmark
+def world_init(path, options):
+    for i in range(100):
+        minecraft.World(path)
+    return 100
+
+@benchmark
+def chunk_init(path, options):
+    # No cache, so every chunk is inflated and parsed
+    world = minecraft.World(path)
+    world.cache_budget = 0
+    coordinates = chunk_coordinates(options.chunks)
+    for x, z in coordinates:
+        minecraft.Chunk(world, x, z)
+    return len(coordinates)
+
+@benchmark
+def chunk_init_cached(path, options):
+    world = minecraft.World(path)
+    coordinates = chunk_coordinates(options.chunks)
+    for x, z in coordinates:
+        minecraft.Chunk(world, x, z)
+
+    start = time.time()
+    for x, z in coordinates:
+        minecraft.Chunk(world, x, z)
+    return len(coordinates), time.time() - start
+
+@benchmark
+def get_block(path, options):
+    world = minecraft.World(path)
+    world.get_block(0, 0, 0)
+    count = 0
+    start = time.time()
+    for x in range(64):
+        for z in range(64):
+            for y in range(0, 64, 4):
+                world.get_block(x, y, z)
+                count += 1
+    return count, time.time() - start
+
+@benchmark
+def put_block(path, options):
+    world = minecraft.World(path)
+    world.get_block(0, 0, 0)
+    block = minecraft.Block(4, 0, 0, 0)
+    count = 0
+    start = time.time()
+    for x in range(64):
+        for z in range(64):
+            for y in range(0, 64, 4):
+                world.put_block(x, y, z, block)
+                count += 1
+    return count, time.time() - start
+
+@benchmark
+def update_region_growing(path, options):
+    # Noise makes the chunk compress worse with every round, so it needs more
+    # sectors and everything after it in the region has to move
+    world = minecraft.World(path)
+    chunk = minecraft.Chunk(world, 0, 0)
+    rnd = random.Random(2)
+    elapsed = 0.0
+    for round in range(16):
+        for i in range(512):
+            chunk.put_block(rnd.randrange(16), rnd.randrange(64), rnd.randrange(16), minecraft.Block(rnd.randrange(1, 128), 0, 0, 0))
+        start = time.time()
+        chunk.save()
+        elapsed += time.time() - start
+    return 16, elapsed
+
+@benchmark
+def save_region(path, options):
+    world = minecraft.World(path)
+    world.load_region(0, 0)
+    for i in range(10):
+        world.save_region(0, 0)
+    return 10
+
+@benchmark
+def generator_noise(path, options):
+    generator = minecraft.Generator(1)
+    count = 0
+    start = time.time()
+    for x in range(32):
+        for y in range(32):
+            for z in range(32):
+                generator.noise(x * 0.1, y * 0.1, z * 0.1)
+                count += 1
+    return count, time.time() - start
+
+"""
+
+Harness
+
+"""
+def run(function, world, options):
+    best = None
+    for i in range(options.repeat):
+        scratch = tempfile.mkdtemp(prefix='bench-')
+        path = os.path.join(scratch, 'world')
+        shutil.copytree(world, path)
+        try:
+            start = time.time()
+            result = function(path, options)
+            elapsed = time.time() - start
+        finally:
+            shutil.rmtree(scratch)
+
+        # Benchmarks with set-up to leave out time themselves
+        if isinstance(result, tuple):
+            ops, elapsed = result
+        else:
+            ops = result
+
+        if best is None or elapsed < best[1]:
+            best = (ops, elapsed)
+
+    ops, elapsed = best
+    return {'ops': ops, 'seconds': elapsed, 'ns_per_op': elapsed * 1e9 / ops}
+
+def commit():
+    try:
+        return subprocess.check_output(['git', 'rev-parse', 'HEAD'], cwd=ROOT, stderr=open(os.devnull, 'w')).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+def compare(results, old):
+    print '%-24s %12s %12s %8s' % ('benchmark', 'old ns/op', 'new ns/op', 'change')
+    for name in sorted(results):
+        new = results[name]['ns_per_op']
+        if name not in old:
+            print '%-24s %12s %12.1f' % (name, '-', new)
+            continue
+        previous = old[name]['ns_per_op']
+        print '%-24s %12.1f %12.1f %+7.1f%%' % (name, previous, new, (new - previous) * 100.0 / previous)
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [options] [benchmark ...]')
+    parser.add_option('-o', '--output', help='write JSON results to this file (default: stdout)')
+    parser.add_option('--compare', help='JSON results from an earlier run to compare against')
+    parser.add_option('--repeat', type='int', default=5, help='runs per benchmark, best kept (default: 5)')
+    parser.add_option('--world', help='use this world directory instead of generating one')
+    parser.add_option('--chunks', type='int', default=256, help='chunks per generated region (default: 256)')
+    parser.add_option('--sections', type='int', default=4, help='sections per generated chunk (default: 4)')
+    options, names = parser.parse_args()
+
+    # Logging below warnings would be timed along with everything else
+    minecraft.set_log_level(minecraft.LOG_WARNING)
+
+    selected = [b for b in BENCHMARKS if not names or b.__name__ in names]
+    if not selected:
+        parser.error('no benchmarks match %s' % ', '.join(names))
+
+    scratch = None
+    world = options.world
+    if world is None:
+        scratch = tempfile.mkdtemp(prefix='bench-world-')
+        world = os.path.join(scratch, 'world')
+        make_world(world, chunks=options.chunks, sections=options.sections)
+
+    results = {}
+    try:
+        for function in selected:
+            results[function.__name__] = run(function, world, options)
+            sys.stderr.write('%-24s %12.1f ns/op\n' % (function.__name__, results[function.__name__]['ns_per_op']))
+    finally:
+        if scratch is not None:
+            shutil.rmtree(scratch)
+
+    report = {
+        'commit': commit(),
+        'python': sys.version.split()[0],
+        'world': {'chunks': options.chunks, 'sections': options.sections} if options.world is None else options.world,
+        'repeat': options.repeat,
+        'results': results,
+    }
+
+    if options.output:
+        f = open(options.output, 'w')
+        json.dump(report, f, indent=2, sort_keys=True)
+        f.close()
+    else:
+        print json.dumps(report, indent=2, sort_keys=True)
+
+    if options.compare:
+        compare(results, json.load(open(options.compare))['results'])
+
+if __name__ == '__main__':
+    main()
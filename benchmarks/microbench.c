@@ -0,0 +1,355 @@
+/*
+microbench.c
+
+Benchmarks for the NBT, compression and region kernels on their own, linked
+straight against nbt.c, region.c and their helpers so there's no interpreter in the
+timed loops (Python is only initialised for the objects get_tag builds).  The
+chunks of a recorded region file are decompressed up front, and every kernel
+is then run over all of them, reporting cycles per byte of input.
+
+    make
+    ./microbench path/to/r.0.0.mca [rounds]
+*/
+
+#include <Python.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "minecraft.h"
+#include "tags.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define MAX_BENCH_CHUNKS    1024
+#define BENCH_BUFFER_SIZE   1000000 // CHUNK_INFLATE_MAX and CHUNK_DEFLATE_MAX
+
+typedef struct {
+    int x, z;
+    int compressed_size, size;
+    unsigned char *compressed; // As stored in the region, after the header
+    unsigned char *buffer;     // Decompressed NBT
+    PyObject *dict;
+} RecordedChunk;
+
+static RecordedChunk chunks[MAX_BENCH_CHUNKS];
+static int chunk_count;
+
+// Time stamp counter where there is one, otherwise nanoseconds
+static unsigned long long cycles( void )
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+static void report( const char *name, unsigned long long elapsed, double bytes, int rounds )
+{
+    printf("%-18s %12.2f cycles/byte %14.0f cycles/round %12.0f bytes/round\n",
+        name, elapsed / bytes, (double) elapsed / rounds, bytes / rounds);
+    fflush(stdout);
+}
+
+static Region *read_region( char *filename )
+{
+    FILE *fp;
+    struct stat st;
+    Region *region;
+
+    fp = fopen(filename, "rb");
+    if( fp == NULL || fstat(fileno(fp), &st) != 0 )
+    {
+        fprintf(stderr, "Unable to read %s\n", filename);
+        exit(1);
+    }
+
+    region = calloc(1, sizeof(Region));
+    region->buffer_size = st.st_size + REGION_BUFFER_PADDING;
+    region->buffer = calloc(region->buffer_size, 1);
+    region->current_size = st.st_size;
+    if( fread(region->buffer, 1, st.st_size, fp) != (size_t) st.st_size )
+    {
+        fprintf(stderr, "Short read from %s\n", filename);
+        exit(1);
+    }
+    fclose(fp);
+
+    return region;
+}
+
+static Region *copy_region( Region *region )
+{
+    Region *copy;
+
+    copy = calloc(1, sizeof(Region));
+    *copy = *region;
+    copy->buffer = malloc(region->buffer_size);
+    memcpy(copy->buffer, region->buffer, region->buffer_size);
+    return copy;
+}
+
+// Decompress and parse every chunk in the region, to have something to time
+static void record_chunks( Region *region )
+{
+    int i;
+
+    for( i = 0; i < 1024 && chunk_count < MAX_BENCH_CHUNKS; i++ )
+    {
+        RecordedChunk *chunk;
+        unsigned char *start;
+        int offset, moved;
+
+        offset = swap_endianness(region->buffer + i * 4, 3) * 4096;
+        if( offset == 0 || offset + 5 > region->current_size )
+            continue;
+
+        chunk = &chunks[chunk_count];
+        start = region->buffer + offset;
+        chunk->x = region->x * 32 + (i & 31);
+        chunk->z = region->z * 32 + (i >> 5);
+        chunk->compressed_size = swap_endianness(start, 4) - 1;
+        chunk->compressed = start + 5;
+        chunk->buffer = malloc(BENCH_BUFFER_SIZE);
+        if( inf(chunk->buffer, chunk->compressed, chunk->compressed_size, 0, &chunk->size) < 0 )
+        {
+            PyErr_Clear();
+            free(chunk->buffer);
+            continue;
+        }
+
+        moved = 0;
+        chunk->dict = get_tag(chunk->buffer, -1, &moved);
+        chunk_count++;
+    }
+}
+
+static void bench_inf( int rounds )
+{
+    unsigned char *out;
+    unsigned long long start, elapsed;
+    double bytes;
+    int r, i;
+
+    out = malloc(BENCH_BUFFER_SIZE);
+    elapsed = 0;
+    bytes = 0;
+    for( r = 0; r < rounds; r++ )
+        for( i = 0; i < chunk_count; i++ )
+        {
+            start = cycles();
+            inf(out, chunks[i].compressed, chunks[i].compressed_size, 0, NULL);
+            elapsed += cycles() - start;
+            bytes += chunks[i].size;
+        }
+    free(out);
+
+    report("inf", elapsed, bytes, rounds);
+}
+
+static void bench_def( int rounds )
+{
+    unsigned char *out;
+    unsigned long long start, elapsed;
+    double bytes;
+    int r, i, size;
+
+    out = malloc(BENCH_BUFFER_SIZE);
+    elapsed = 0;
+    bytes = 0;
+    for( r = 0; r < rounds; r++ )
+        for( i = 0; i < chunk_count; i++ )
+        {
+            start = cycles();
+            def(out, chunks[i].buffer, chunks[i].size, 0, &size);
+            elapsed += cycles() - start;
+            bytes += chunks[i].size;
+        }
+    free(out);
+
+    report("def", elapsed, bytes, rounds);
+}
+
+static void bench_get_tag( int rounds )
+{
+    unsigned long long start, elapsed;
+    double bytes;
+    int r, i;
+
+    elapsed = 0;
+    bytes = 0;
+    for( r = 0; r < rounds; r++ )
+        for( i = 0; i < chunk_count; i++ )
+        {
+            PyObject *dict;
+            int moved;
+
+            moved = 0;
+            start = cycles();
+            dict = get_tag(chunks[i].buffer, -1, &moved);
+            elapsed += cycles() - start;
+            bytes += chunks[i].size;
+
+            // Freeing it is part of the cost of a Chunk, but not of parsing
+            Py_XDECREF(dict);
+        }
+
+    report("get_tag", elapsed, bytes, rounds);
+}
+
+static void bench_write_tags( int rounds )
+{
+    unsigned char *out;
+    unsigned long long start, elapsed;
+    double bytes;
+    int r, i;
+
+    out = malloc(BENCH_BUFFER_SIZE);
+    elapsed = 0;
+    bytes = 0;
+    for( r = 0; r < rounds; r++ )
+        for( i = 0; i < chunk_count; i++ )
+        {
+            start = cycles();
+            bytes += write_tags(out, chunks[i].dict, chunk_tags);
+            elapsed += cycles() - start;
+        }
+    free(out);
+
+    report("write_tags", elapsed, bytes, rounds);
+}
+
+static void bench_swap_endianness( Region *region, int rounds )
+{
+    unsigned long long start, elapsed;
+    volatile long sink;
+    long sum;
+    int r, i;
+
+    // The location table (3 bytes per entry) and timestamps (4 bytes)
+    elapsed = 0;
+    for( r = 0; r < rounds * 100; r++ )
+    {
+        sum = 0;
+        start = cycles();
+        for( i = 0; i < 4096; i += 4 )
+            sum += swap_endianness(region->buffer + i, 3);
+        for( i = 4096; i < 8192; i += 4 )
+            sum += swap_endianness(region->buffer + i, 4);
+        elapsed += cycles() - start;
+        sink = sum;
+    }
+    (void) sink;
+
+    report("swap_endianness", elapsed, (double) rounds * 100 * 7168, rounds * 100);
+}
+
+static void bench_region_end( Region *region, int rounds )
+{
+    unsigned long long start, elapsed;
+    volatile int sink;
+    int r;
+
+    elapsed = 0;
+    for( r = 0; r < rounds * 100; r++ )
+    {
+        start = cycles();
+        sink = region_end(region);
+        elapsed += cycles() - start;
+    }
+    (void) sink;
+
+    report("region_end", elapsed, (double) rounds * 100 * 4096, rounds * 100);
+}
+
+/*
+Writes every chunk back into a copy of the region, which runs the header
+scans and index adjustment in update_region along with serialising and
+compressing the chunk.  Bytes are those of the region buffer it works on.
+*/
+static void bench_update_region( Region *region, int rounds )
+{
+    unsigned long long start, elapsed;
+    double bytes;
+    int r, i;
+
+    elapsed = 0;
+    bytes = 0;
+    for( r = 0; r < rounds; r++ )
+    {
+        Region *copy;
+
+        copy = copy_region(region);
+        for( i = 0; i < chunk_count; i++ )
+        {
+            Chunk chunk;
+
+            memset(&chunk, 0, sizeof(Chunk));
+            chunk.x = chunks[i].x;
+            chunk.z = chunks[i].z;
+            chunk.dict = chunks[i].dict;
+
+            start = cycles();
+            update_region(copy, &chunk);
+            elapsed += cycles() - start;
+
+            bytes += copy->current_size;
+        }
+        free(copy->buffer);
+        free(copy);
+    }
+
+    report("update_region", elapsed, bytes, rounds);
+}
+
+int main( int argc, char **argv )
+{
+    Region *region;
+    int rounds, rx, rz;
+    char *name;
+
+    if( argc < 2 )
+    {
+        fprintf(stderr, "Usage: %s region_file [rounds]\n", argv[0]);
+        return 1;
+    }
+    rounds = argc > 2 ? atoi(argv[2]) : 10;
+
+    Py_Initialize();
+    init_tag_keys();
+
+    region = read_region(argv[1]);
+    name = strrchr(argv[1], '/');
+    if( sscanf(name != NULL ? name + 1 : argv[1], "r.%d.%d.", &rx, &rz) == 2 )
+    {
+        region->x = rx;
+        region->z = rz;
+    }
+
+    record_chunks(region);
+    if( chunk_count == 0 )
+    {
+        fprintf(stderr, "No chunks found in %s\n", argv[1]);
+        return 1;
+    }
+    printf("%d chunks, %d rounds\n", chunk_count, rounds);
+
+    bench_inf(rounds);
+    bench_def(rounds);
+    bench_get_tag(rounds);
+    bench_write_tags(rounds);
+    bench_swap_endianness(region, rounds);
+    bench_region_end(region, rounds);
+    bench_update_region(region, rounds);
+
+    Py_Finalize();
+    return 0;
+}
@@ -9,6 +9,39 @@ Block object
 #include <stdbool.h>
 #include "minecraft.h"
 
+/*
+Blocks are immutable, so lookups hand out shared instances from a small
+direct-mapped cache rather than building a new object for every read
+*/
+static Block *block_cache[BLOCK_CACHE_SIZE];
+
+// Get a Block for a packed value (see PACK_BLOCK), as a new reference
+PyObject *get_block_object( int packed )
+{
+    Block *block;
+    unsigned int slot;
+
+    slot = ((unsigned int) packed * 2654435761u) % BLOCK_CACHE_SIZE;
+    block = block_cache[slot];
+    if( block == NULL || PACK_BLOCK(block->id, block->data, block->blocklight, block->skylight) != packed )
+    {
+        block = (Block *) minecraft_BlockType.tp_alloc(&minecraft_BlockType, 0);
+        if( block == NULL )
+            return NULL;
+
+        block->id = packed & 0xFFF;
+        block->data = (packed >> 12) & 0x0F;
+        block->blocklight = (packed >> 16) & 0x0F;
+        block->skylight = (packed >> 20) & 0x0F;
+
+        Py_XDECREF(block_cache[slot]);
+        block_cache[slot] = block; // Cache entry reference
+    }
+
+    Py_INCREF(block);
+    return (PyObject *) block;
+}
+
 /*
 
 Python object-related code
@@ -36,10 +69,10 @@ int Block_init( Block *self, PyObject *args, PyObject *kwds )
 }
 
 static PyMemberDef Block_members[] = {
-    {"id", T_USHORT, offsetof(Block, id), 0, "Block ID, twelve bits"},
-    {"data", T_UBYTE, offsetof(Block, data), 0, "Four bits of additional block data"},
-    {"blocklight", T_UBYTE, offsetof(Block, blocklight), 0, "Four bits recording the amount of block-emitted light in each block"},
-    {"skylight", T_UBYTE, offsetof(Block, skylight), 0, "Four bits recording the amount of sunlight or moonlight hitting each block"},
+    {"id", T_USHORT, offsetof(Block, id), READONLY, "Block ID, twelve bits"},
+    {"data", T_UBYTE, offsetof(Block, data), READONLY, "Four bits of additional block data"},
+    {"blocklight", T_UBYTE, offsetof(Block, blocklight), READONLY, "Four bits recording the amount of block-emitted light in each block"},
+    {"skylight", T_UBYTE, offsetof(Block, skylight), READONLY, "Four bits recording the amount of sunlight or moonlight hitting each block"},
     {NULL}
 };
 
@@ -0,0 +1,163 @@
+/*
+cache.c
+
+Cache of decompressed chunk buffers, so that loading a chunk again doesn't
+inflate it again.  Entries are keyed by region and chunk index within the
+region, kept in least-recently used order, and dropped oldest first once the
+total size of the buffers goes over the World's cache_budget.  update_region
+invalidates a chunk's entry whenever the chunk is written back.
+*/
+
+#include <Python.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minecraft.h"
+#include "stats.h"
+
+static int cache_hash( int region_x, int region_z, int index )
+{
+    unsigned int hash;
+
+    hash = ((unsigned int) region_x << 20) ^ ((unsigned int) region_z << 10) ^ (unsigned int) index;
+    return hash % CHUNK_CACHE_BUCKETS;
+}
+
+/*
+Finds the entry for a chunk, given its region and index in the region.  If
+link isn't NULL, it's pointed at the hash chain pointer that refers (or would
+refer) to the entry.
+*/
+static CacheEntry *find_entry( ChunkCache *cache, int region_x, int region_z, int index, CacheEntry ***link )
+{
+    CacheEntry **entry;
+
+    entry = &cache->buckets[cache_hash(region_x, region_z, index)];
+    while( *entry != NULL )
+    {
+        if( (*entry)->region_x == region_x && (*entry)->region_z == region_z && (*entry)->index == index )
+            break;
+        entry = &(*entry)->hash_next;
+    }
+
+    if( link != NULL )
+        *link = entry;
+    return *entry;
+}
+
+// Take an entry out of the recently-used list
+static void unlink_entry( ChunkCache *cache, CacheEntry *entry )
+{
+    if( entry->newer != NULL )
+        entry->newer->older = entry->older;
+    else
+        cache->newest = entry->older;
+
+    if( entry->older != NULL )
+        entry->older->newer = entry->newer;
+    else
+        cache->oldest = entry->newer;
+}
+
+// Put an entry at the most recently used end of the list
+static void push_entry( ChunkCache *cache, CacheEntry *entry )
+{
+    entry->older = cache->newest;
+    entry->newer = NULL;
+    if( cache->newest != NULL )
+        cache->newest->newer = entry;
+    else
+        cache->oldest = entry;
+    cache->newest = entry;
+}
+
+static void remove_entry( ChunkCache *cache, CacheEntry *entry )
+{
+    CacheEntry **link;
+
+    find_entry(cache, entry->region_x, entry->region_z, entry->index, &link);
+    *link = entry->hash_next;
+    unlink_entry(cache, entry);
+
+    cache->bytes -= entry->size;
+    free(entry->buffer);
+    free(entry);
+}
+
+/*
+Returns the cached decompressed buffer for the chunk at (x, z), or NULL if
+there isn't one.  The buffer belongs to the cache and stays valid until the
+next insert or invalidation.
+*/
+unsigned char *cache_lookup( ChunkCache *cache, int x, int z )
+{
+    CacheEntry *entry;
+
+    entry = find_entry(cache, x >> 5, z >> 5, (x & 31) + (z & 31) * 32, NULL);
+    if( entry == NULL )
+    {
+        STAT_ADD(STAT_CACHE_MISSES, 1);
+        return NULL;
+    }
+    STAT_ADD(STAT_CACHE_HITS, 1);
+
+    unlink_entry(cache, entry);
+    push_entry(cache, entry);
+    return entry->buffer;
+}
+
+/*
+Stores a copy of the first size bytes of a decompressed chunk buffer, making
+room by dropping the least recently used chunks.  Chunks bigger than the
+whole budget aren't cached.
+*/
+void cache_insert( ChunkCache *cache, int x, int z, unsigned char *buffer, int size )
+{
+    CacheEntry *entry, **link;
+
+    cache_invalidate(cache, x, z);
+    if( size <= 0 || size > cache->budget )
+        return;
+
+    while( cache->oldest != NULL && cache->bytes + size > cache->budget )
+        remove_entry(cache, cache->oldest);
+
+    entry = malloc(sizeof(CacheEntry));
+    if( entry == NULL )
+        return;
+    entry->buffer = malloc(size);
+    if( entry->buffer == NULL )
+    {
+        free(entry);
+        return;
+    }
+    memcpy(entry->buffer, buffer, size);
+
+    entry->region_x = x >> 5;
+    entry->region_z = z >> 5;
+    entry->index = (x & 31) + (z & 31) * 32;
+    entry->size = size;
+
+    // Invalidated above, so this is always the end of the chain
+    find_entry(cache, entry->region_x, entry->region_z, entry->index, &link);
+    entry->hash_next = NULL;
+    *link = entry;
+    push_entry(cache, entry);
+    cache->bytes += size;
+}
+
+// Drops the cached buffer for the chunk at (x, z), if there is one
+void cache_invalidate( ChunkCache *cache, int x, int z )
+{
+    CacheEntry *entry;
+
+    entry = find_entry(cache, x >> 5, z >> 5, (x & 31) + (z & 31) * 32, NULL);
+    if( entry != NULL )
+        remove_entry(cache, entry);
+}
+
+void clear_cache( ChunkCache *cache )
+{
+    while( cache->oldest != NULL )
+        remove_entry(cache, cache->oldest);
+}
@@ -8,33 +8,35 @@ Provides functionality for Chunk objects
 #include <structmember.h>
 #include <stdbool.h>
 #include "minecraft.h"
+#include "log.h"
+#include "stats.h"
 #include "tags.h"
 
 // Takes a region file stream and a chunk location and finds and decompresses
 // the chunk to the passed buffer
-int decompress_chunk( unsigned char *region, unsigned char *decompressed, int x, int z )
+int decompress_chunk( unsigned char *region, unsigned char *decompressed, int x, int z, int *size )
 {
     unsigned int header_offset, chunk_offset, chunk_length, compression_type;
     int rc;
 
-    printf("Finding chunk (%d, %d)\n", x, z);
+    log_debug("Finding chunk (%d, %d)", x, z);
     header_offset = 4 *((x & 31) + (z & 31) * 32);
 
     chunk_offset = swap_endianness(region + header_offset, 3) * 4096;
     if ( chunk_offset == 0 )
     {
-        printf("Chunk is empty, crap!\n");
+        log_debug("Chunk (%d, %d) is empty", x, z);
         return 1;
     }
 
-    printf("Offset: %d | Length: %d\n", chunk_offset, *(region + header_offset + 3) * 4096);
+    log_debug("Offset: %d | Length: %d", chunk_offset, *(region + header_offset + 3) * 4096);
 
     // Read the chunk length from the start of the chunk
     chunk_length = swap_endianness(region + chunk_offset, 4);
     compression_type = *(region + chunk_offset + 4);
-    printf("True Length: %d | Compression: %d\n", chunk_length, compression_type);
+    log_debug("True Length: %d | Compression: %d", chunk_length, compression_type);
 
-    rc = inf(decompressed, region + chunk_offset + 5, chunk_length - 1, 0);
+    rc = inf(decompressed, region + chunk_offset + 5, chunk_length - 1, 0, size);
 
     if( rc < 0 )
     {
@@ -61,22 +63,36 @@ int Chunk_init( Chunk *self, PyObject *args, PyObject *kwds )
 {
     Region *region;
     PyObject *old, *dict, *world;
-    unsigned char *buffer; // TODO: Dynamically allocate
-    int moved, rc;
+    unsigned char *buffer, *cached;
+    int moved, rc, size;
+    unsigned long long start, began;
+    size_t mark;
 
     if( !PyArg_ParseTuple(args, "Oii", &world, &self->x, &self->z) )
         return -1;
+    began = stats_clock();
+    mark = arena_mark();
 
-    buffer = calloc(1000000, 1);
+    // A chunk decoded before can skip the region and inflate entirely
+    cached = cache_lookup(&((World *) world)->cache, self->x, self->z);
+    if( cached == NULL )
+    {
+        buffer = arena_alloc(CHUNK_BUFFER_SIZE);
 
-    region = load_region((World *) world, self->x >> 5, self->z >> 5);
-    rc = decompress_chunk(region->buffer, buffer, self->x, self->z);
+        region = load_region((World *) world, self->x >> 5, self->z >> 5);
+        rc = decompress_chunk(region->buffer, buffer, self->x, self->z, &size);
 
-    if( rc != 0 )
-    {
-        PyErr_Format(PyExc_Exception, "CHUNK EMPTY!");
-        dump_buffer(buffer, 480);
-        return -1;
+        if( rc != 0 )
+        {
+            PyErr_Format(PyExc_Exception, "CHUNK EMPTY!");
+            if( LOG_ENABLED(LOG_DEBUG) )
+                dump_buffer(buffer, 480);
+            arena_release(mark);
+            return -1;
+        }
+
+        cache_insert(&((World *) world)->cache, self->x, self->z, buffer, size);
+        cached = buffer;
     }
 
     // dump_buffer(buffer, 4800);
@@ -84,8 +100,10 @@ int Chunk_init( Chunk *self, PyObject *args, PyObject *kwds )
     // Read chunk to dictionary
     moved = 0;
     old = self->dict;
-    dict = get_tag(buffer, -1, &moved);
-    printf("Chunk moved: %d\n", moved);
+    start = stats_clock();
+    dict = get_tag(cached, -1, &moved);
+    STAT_ADD(STAT_NBT_PARSE_NS, stats_clock() - start);
+    log_debug("Chunk moved: %d", moved);
     Py_INCREF(dict);
     self->dict = dict;
     Py_XDECREF(old);
@@ -96,7 +114,8 @@ int Chunk_init( Chunk *self, PyObject *args, PyObject *kwds )
     self->world = world;
     Py_XDECREF(old);
 
-    free(buffer);
+    arena_release(mark);
+    end_span(SPAN_CHUNK_LOAD, began, self->x, self->z);
 
     return 0;
 }
@@ -113,221 +132,423 @@ static PyObject *Chunk_save( Chunk *self )
     return Py_None;
 }
 
-char get_nibble( char *byte_array, int index )
+/*
+Fills arrays with pointers to the storage of every section in the chunk.  If
+compact is given, compact sections (see palette.c) are left as they are and
+put in it by section Y instead, with NULL for the others; otherwise they're
+expanded.  Returns 0, or -1 (with an exception set) if the chunk has no
+sections list.
+*/
+int read_chunk_arrays( Chunk *chunk, ChunkArrays *arrays, PyObject **compact )
 {
-    return index % 2 == 0 ? byte_array[index / 2] & 0x0F : byte_array[index / 2]>>4 & 0x0F;
+    PyObject *level, *sections;
+    int i, size;
+
+    memset(arrays, 0, sizeof(ChunkArrays));
+    if( compact != NULL )
+        memset(compact, 0, 16 * sizeof(PyObject *));
+
+    level = PyDict_GetItem(chunk->dict, key_level);
+    sections = level == NULL ? NULL : PyDict_GetItem(level, key_sections);
+    if( sections == NULL )
+    {
+        PyErr_Format(PyExc_Exception, "Chunk (%d, %d) has no sections", chunk->x, chunk->z);
+        return -1;
+    }
+
+    size = PyList_Size(sections);
+    for( i = 0; i < size; i++ )
+    {
+        PyObject *section, *array;
+        int y;
+
+        section = PyList_GetItem(sections, i);
+        y = PyInt_AsLong(PyDict_GetItem(section, key_y));
+        if( y < 0 || y > 15 )
+            continue;
+
+        if( compact != NULL && is_compact(section) )
+        {
+            compact[y] = section;
+            continue;
+        }
+        expand_section(section);
+
+        if( (array = PyDict_GetItem(section, key_blocks)) != NULL )
+            arrays->blocks[y] = (unsigned char *) PyByteArray_AsString(array);
+        if( (array = PyDict_GetItem(section, key_add)) != NULL )
+            arrays->add[y] = (unsigned char *) PyByteArray_AsString(array);
+        if( (array = PyDict_GetItem(section, key_data)) != NULL )
+            arrays->data[y] = (unsigned char *) PyByteArray_AsString(array);
+        if( (array = PyDict_GetItem(section, key_block_light)) != NULL )
+            arrays->blocklight[y] = (unsigned char *) PyByteArray_AsString(array);
+        if( (array = PyDict_GetItem(section, key_sky_light)) != NULL )
+            arrays->skylight[y] = (unsigned char *) PyByteArray_AsString(array);
+    }
+
+    return 0;
 }
 
-void set_nibble( char *byte_array, int index, unsigned char value )
+// The flat arrays of every section in the chunk, expanding any compact ones
+int get_chunk_arrays( Chunk *chunk, ChunkArrays *arrays )
 {
-    char existing;
-
-    value = value & 0x0F; // Ensure only the lower 4 bits are set
-    value = index % 2 == 0 ? value : value << 4;
-    existing = index % 2 == 0 ? byte_array[index / 2] & 0xF0 : byte_array[index / 2] & 0x0F;
-    byte_array[index / 2] = existing | value;
+    return read_chunk_arrays(chunk, arrays, NULL);
 }
 
-// Currently, it is expected that passed arguments will be in coordinates
-// relative to the chunk
-PyObject *Chunk_get_block( Chunk *self, PyObject *args )
+/*
+Creates an empty (air) section at section height y and adds it to the chunk,
+returning a borrowed reference to it.  Skylight starts out full above the
+chunk's heightmap, and dark below it.  If the world compacts its chunks and
+the heightmap doesn't pass through the section, that leaves it uniform (see
+palette.c), with no arrays at all; otherwise it gets the usual flat arrays.
+*/
+PyObject *create_section( Chunk *chunk, int y )
 {
-    PyObject *block_args, *block, *level, *sections, *section;
-    int i, size, x, y, z;
+    PyObject *level, *sections, *heightmap, *section, *new;
+    unsigned char *skylight;
+    int i, low, high, top[256];
+
+    level = PyDict_GetItem(chunk->dict, key_level);
+    sections = PyDict_GetItem(level, key_sections);
+    heightmap = PyDict_GetItem(level, key_height_map);
+    log_debug("Creating new section (%d)", y);
+
+    low = 256;
+    high = 0;
+    for( i = 0; i < 256; i++ )
+    {
+        top[i] = heightmap != NULL && PyList_Size(heightmap) == 256 ? PyInt_AsLong(PyList_GetItem(heightmap, i)) : 0;
+        if( top[i] < low )
+            low = top[i];
+        if( top[i] > high )
+            high = top[i];
+    }
 
-    if( !PyArg_ParseTuple(args, "iii", &x, &y, &z) )
+    section = PyDict_New();
+
+    new = PyInt_FromLong(y);
+    PyDict_SetItem(section, key_y, new);
+    Py_DECREF(new);
+
+    if( chunk->world != NULL && ((World *) chunk->world)->compact_chunks &&
+        (high <= y * 16 || low >= y * 16 + 16) )
     {
-        PyErr_Format(PyExc_Exception, "Unable to parse arguments.");
+        make_uniform(section, PACK_BLOCK(0, 0, 0, high <= y * 16 ? 15 : 0));
 
-        Py_INCREF(Py_None);
-        return Py_None;
+        PyList_Append(sections, section);
+        Py_DECREF(section);
+        return section;
     }
 
-    level = PyDict_GetItemString(self->dict, "Level");
-    sections = PyDict_GetItemString(level, "Sections");
+    // Add doesn't necessarily exist, so we don't need to account for it
+    new = PyByteArray_FromStringAndSize(NULL, 4096);
+    memset(PyByteArray_AsString(new), 0, 4096);
+    PyDict_SetItem(section, key_blocks, new);
+    Py_DECREF(new);
+
+    new = PyByteArray_FromStringAndSize(NULL, 2048);
+    memset(PyByteArray_AsString(new), 0, 2048);
+    PyDict_SetItem(section, key_data, new);
+    Py_DECREF(new);
+
+    new = PyByteArray_FromStringAndSize(NULL, 2048);
+    memset(PyByteArray_AsString(new), 0, 2048);
+    PyDict_SetItem(section, key_block_light, new);
+    Py_DECREF(new);
+
+    new = PyByteArray_FromStringAndSize(NULL, 2048);
+    skylight = (unsigned char *) PyByteArray_AsString(new);
+    memset(skylight, 0, 2048);
+    for( i = 0; i < 4096; i++ )
+        if( y * 16 + (i >> 8) >= top[i & 255] )
+            skylight[i >> 1] |= (i & 1) ? 0xF0 : 0x0F;
+    PyDict_SetItem(section, key_sky_light, new);
+    Py_DECREF(new);
+
+    PyList_Append(sections, section);
+    Py_DECREF(section);
+
+    return section;
+}
+
+// The section at section height y as it's stored, which may be compact
+PyObject *find_section( Chunk *chunk, int y )
+{
+    PyObject *level, *sections;
+    int i, size;
+
+    level = PyDict_GetItem(chunk->dict, key_level);
+    sections = PyDict_GetItem(level, key_sections);
     size = PyList_Size(sections);
-    section = NULL;
     for( i = 0; i < size; i++ )
     {
-        PyObject *current_section;
-        int sub_y;
+        PyObject *section;
 
-        current_section = PyList_GetItem(sections, i);
-        sub_y = PyInt_AsLong(PyDict_GetItemString(current_section, "Y"));
-        if( sub_y == y / 16 )
-        {
-            section = current_section;
-            break;
-        }
+        section = PyList_GetItem(sections, i);
+        if( PyInt_AsLong(PyDict_GetItem(section, key_y)) == y )
+            return section;
     }
 
+    return NULL;
+}
+
+/*
+Finds the section at section height y, creating it if it's missing and create
+is set, and expanding it if it's compact.  Returns a borrowed reference, or
+NULL if there's no such section.
+*/
+PyObject *get_section( Chunk *chunk, int y, bool create )
+{
+    PyObject *section;
+
+    section = find_section(chunk, y);
     if( section == NULL )
-        block_args = Py_BuildValue("HBBB", 0, 0, 0, 0);
-    else
     {
-        int section_y, position;
-        unsigned short id;
-        unsigned char data, blocklight, skylight;
-        char *byte_array;
+        if( !create )
+            return NULL;
+        section = create_section(chunk, y);
+    }
 
-        data = blocklight = skylight = 0;
-        section_y = y % 16;
-        position = section_y * 16 * 16 + z * 16 + x;
+    expand_section(section);
+    return section;
+}
 
-        // We know it will contain the "Blocks" byte array
-        byte_array = (char *) PyDict_GetItemString(section, "Blocks");
-        id = (short) byte_array[position];
+/*
+Remember that the columns from (x1, z1) to (x2, z2) inclusive changed, from y
+upwards, for the next lighting calculation
+*/
+void mark_dirty( Chunk *chunk, int x1, int z1, int x2, int z2, int y )
+{
+    int x, z;
 
-        if( PyDict_Contains(section, PyString_FromString("Add")) )
-        {
-            byte_array = (char *) PyDict_GetItemString(section, "Add");
-            id += get_nibble(byte_array, position) << 8;
-        }
+    for( z = z1; z <= z2; z++ )
+        for( x = x1; x <= x2; x++ )
+            chunk->dirty_columns[(z * 16 + x) >> 3] |= 1 << ((z * 16 + x) & 7);
 
-        if( PyDict_Contains(section, PyString_FromString("Data")) )
-        {
-            byte_array = (char *) PyDict_GetItemString(section, "Data");
-            data = get_nibble(byte_array, position);
-        }
-        
-        if( PyDict_Contains(section, PyString_FromString("BlockLight")) )
-        {
-            byte_array = (char *) PyDict_GetItemString(section, "BlockLight");
-            blocklight = get_nibble(byte_array, position);
-        }
-        
-        if( PyDict_Contains(section, PyString_FromString("SkyLight")) )
-        {
-            byte_array = (char *) PyDict_GetItemString(section, "SkyLight");
-            skylight = get_nibble(byte_array, position);
-        }
+    if( !chunk->dirty || y < chunk->dirty_min_y )
+        chunk->dirty_min_y = y;
+    chunk->dirty = true;
+    chunk->modified = true;
+}
 
-        block_args = Py_BuildValue("HBBB", id, data, blocklight, skylight);
+// Even indices live in the low nibble, odd ones in the high nibble
+char get_nibble( char *byte_array, int index )
+{
+    return ((unsigned char) byte_array[index >> 1] >> ((index & 1) << 2)) & 0x0F;
+}
+
+void set_nibble( char *byte_array, int index, unsigned char value )
+{
+    int shift;
+
+    shift = (index & 1) << 2;
+    byte_array[index >> 1] = (byte_array[index >> 1] & (0xF0 >> shift)) | (value & 0x0F) << shift;
+}
+
+/*
+Looks up a block, packed into an int as id | data << 12 | blocklight << 16 |
+skylight << 20 (see PACK_BLOCK).  Coordinates are relative to the chunk, and
+anything in a missing section reads as 0.
+*/
+int get_block_raw( Chunk *chunk, int x, int y, int z )
+{
+    PyObject *section, *array;
+    int position, id, data, blocklight, skylight;
+
+    section = find_section(chunk, y >> 4);
+    if( section == NULL )
+        return 0;
+
+    position = (y & 15) * 256 + z * 16 + x;
+    if( is_compact(section) )
+        return compact_block_raw(section, position);
+
+    data = blocklight = skylight = 0;
+
+    id = (unsigned char) PyByteArray_AsString(PyDict_GetItem(section, key_blocks))[position];
+    if( (array = PyDict_GetItem(section, key_add)) != NULL )
+        id |= get_nibble(PyByteArray_AsString(array), position) << 8;
+    if( (array = PyDict_GetItem(section, key_data)) != NULL )
+        data = get_nibble(PyByteArray_AsString(array), position);
+    if( (array = PyDict_GetItem(section, key_block_light)) != NULL )
+        blocklight = get_nibble(PyByteArray_AsString(array), position);
+    if( (array = PyDict_GetItem(section, key_sky_light)) != NULL )
+        skylight = get_nibble(PyByteArray_AsString(array), position);
+
+    return PACK_BLOCK(id, data, blocklight, skylight);
+}
+
+// Currently, it is expected that passed arguments will be in coordinates
+// relative to the chunk
+PyObject *Chunk_get_block( Chunk *self, PyObject *args )
+{
+    int x, y, z;
+
+    if( !PyArg_ParseTuple(args, "iii", &x, &y, &z) )
+    {
+        PyErr_Format(PyExc_Exception, "Unable to parse arguments.");
+        return NULL;
     }
 
-    // TODO: Populate with actual block values
-    block_args = Py_BuildValue("HBBB", 0, 0, 0, 0);
-    block = PyObject_CallObject((PyObject *) &minecraft_BlockType, block_args);
-    Py_INCREF(block);
-    return block;
+    return get_block_object(get_block_raw(self, x & 15, y & 255, z & 15));
+}
+
+// Like get_block, but returns the packed int rather than a Block
+static PyObject *Chunk_get_block_raw( Chunk *self, PyObject *args )
+{
+    int x, y, z;
+
+    if( !PyArg_ParseTuple(args, "iii", &x, &y, &z) )
+    {
+        PyErr_Format(PyExc_Exception, "Unable to parse arguments.");
+        return NULL;
+    }
+
+    return PyInt_FromLong(get_block_raw(self, x & 15, y & 255, z & 15));
 }
 
 // Currently, it is expected that passed arguments will be in coordinates
 // relative to the chunk
 PyObject *Chunk_put_block( Chunk *self, PyObject *args )
 {
-    PyObject *level, *sections, *section;
+    PyObject *section;
     Block *block;
-    int i, size, position, x, y, z;
+    int position, x, y, z;
     char *byte_array;
 
-    if( !PyArg_ParseTuple(args, "iiiO", &x, &y, &z, &block) )
+    if( !PyArg_ParseTuple(args, "iiiO!", &x, &y, &z, &minecraft_BlockType, &block) )
     {
         PyErr_Format(PyExc_Exception, "Unable to parse arguments.");
-
-        Py_INCREF(Py_None);
-        return Py_None;
+        return NULL;
     }
 
-    level = PyDict_GetItemString(self->dict, "Level");
-    sections = PyDict_GetItemString(level, "Sections");
-    size = PyList_Size(sections);
-    section = NULL;
-    for( i = 0; i < size; i++ )
-    {
-        PyObject *current_section;
-        int sub_y;
-
-        current_section = PyList_GetItem(sections, i);
-        sub_y = PyInt_AsLong(PyDict_GetItemString(current_section, "Y"));
-        if( sub_y == y / 16 )
-        {
-            section = current_section;
-            break;
-        }
-    }
+    // Remember the column for the next lighting calculation
+    mark_dirty(self, x, z, x, z, y);
 
-    // If a section doesn't exist where this block should go, create it
+    // If a section doesn't exist where this block should go, create it, and
+    // leave it uniform if it's already this block throughout
+    section = find_section(self, y / 16);
     if( section == NULL )
+        section = create_section(self, y / 16);
+    if( is_uniform(section) && (unsigned int) compact_block_raw(section, 0) ==
+        PACK_BLOCK(block->id, block->data, block->blocklight, block->skylight) )
     {
-        PyObject *new;
-
-        new = PyInt_FromLong(y / 16); // This should end up not needing to be INCREF'd I think
-        printf("Creating new section (%ld)\n", PyInt_AsLong(new));
-
-        section = PyDict_New();
-        Py_INCREF(section);
-        
-        Py_INCREF(new);
-        PyDict_SetItemString(section, "Y", new);
-
-        // Add doesn't necessarily exist, so we don't need to account for it
-
-        // Data
-        byte_array = calloc(4096, 1);
-        new = PyByteArray_FromStringAndSize(byte_array, 4096);
-        Py_INCREF(new);
-        PyDict_SetItemString(section, "Blocks", new);
-        free(byte_array);
-
-        // Data, BlockLight, and SkyLight
-        byte_array = calloc(2048, 1);
-        new = PyByteArray_FromStringAndSize(byte_array, 2048);
-        Py_INCREF(new);
-        PyDict_SetItemString(section, "Data", new);
-        new = PyByteArray_FromStringAndSize(byte_array, 2048);
-        Py_INCREF(new);
-        PyDict_SetItemString(section, "BlockLight", new);
-        new = PyByteArray_FromStringAndSize(byte_array, 2048);
-        Py_INCREF(new);
-        PyDict_SetItemString(section, "SkyLight", new);
-        free(byte_array);
-
-        PyList_Append(sections, section);
+        Py_INCREF(Py_None);
+        return Py_None;
     }
+    expand_section(section);
 
     position = (y % 16) * 16 * 16 + z * 16 + x;
-    byte_array = PyByteArray_AsString(PyDict_GetItemString(section, "Blocks"));
+    byte_array = PyByteArray_AsString(PyDict_GetItem(section, key_blocks));
     byte_array[position] = block->id;
 
-    // set "Add", only if the block ID is greater than 0x0F
-    if( block->id >> 8 != 0 )
+    // set "Add" if the block ID needs more than eight bits, or clear what
+    // was there before
+    if( block->id >> 8 != 0 || PyDict_GetItem(section, key_add) != NULL )
     {
-        if( PyDict_Contains(section, PyString_FromString("Add")) == 0 )
+        if( PyDict_Contains(section, key_add) == 0 )
         {
             PyObject *new;
 
             byte_array = calloc(2048, 1);
             new = PyByteArray_FromStringAndSize(byte_array, 2048);
-            Py_INCREF(new);
 
-            PyDict_SetItemString(section, "Add", new);
+            PyDict_SetItem(section, key_add, new);
+            Py_DECREF(new);
             free(byte_array);
         }
 
-        byte_array = PyByteArray_AsString(PyDict_GetItemString(section, "Add"));
-        set_nibble(byte_array, position, block->data >> 8);
+        byte_array = PyByteArray_AsString(PyDict_GetItem(section, key_add));
+        set_nibble(byte_array, position, block->id >> 8);
     }
 
-    byte_array = PyByteArray_AsString(PyDict_GetItemString(section, "Data"));
+    byte_array = PyByteArray_AsString(PyDict_GetItem(section, key_data));
     set_nibble(byte_array, position, block->data);
-    byte_array = PyByteArray_AsString(PyDict_GetItemString(section, "BlockLight"));
+    byte_array = PyByteArray_AsString(PyDict_GetItem(section, key_block_light));
     set_nibble(byte_array, position, block->blocklight);
-    byte_array = PyByteArray_AsString(PyDict_GetItemString(section, "SkyLight"));
+    byte_array = PyByteArray_AsString(PyDict_GetItem(section, key_sky_light));
     set_nibble(byte_array, position, block->skylight);
 
     Py_INCREF(Py_None);
     return Py_None;
 }
 
-// TODO: Placeholder
-// Recalculate lighting and anything else that requires calculation
+/*
+Recalculate the heightmap and skylight.  If blocks have been put since the
+last calculation, only the heightmap of the columns touched is recomputed,
+and skylight is only recomputed from 15 blocks below the lowest change
+(light can't travel further than that); otherwise the whole chunk is lit.
+Light is confined to the chunk.
+*/
 static PyObject *Chunk_calculate( Chunk *self )
 {
+    ChunkArrays arrays;
+    LightScratch *scratch;
+    PyObject *level, *heightmap_list;
+    int i, low, heightmap[256];
+    bool incremental;
+
+    if( get_chunk_arrays(self, &arrays) != 0 )
+        return NULL;
+
+    level = PyDict_GetItem(self->dict, key_level);
+    heightmap_list = PyDict_GetItem(level, key_height_map);
+    incremental = self->dirty && heightmap_list != NULL && PyList_Size(heightmap_list) == 256;
+
+    init_light_tables();
+    scratch = malloc(sizeof(LightScratch));
+    light_load_opacity(&arrays, scratch);
+
+    low = 0;
+    if( incremental )
+    {
+        // Any column whose heightmap moves changes lighting from the lower of
+        // its old and new heights, as well as from the lowest block put
+        low = self->dirty_min_y;
+        for( i = 0; i < 256; i++ )
+        {
+            heightmap[i] = PyInt_AsLong(PyList_GetItem(heightmap_list, i));
+            if( (self->dirty_columns[i >> 3] & (1 << (i & 7))) && heightmap[i] < low )
+                low = heightmap[i];
+        }
+
+        light_heightmap(scratch, heightmap, self->dirty_columns);
+        for( i = 0; i < 256; i++ )
+            if( (self->dirty_columns[i >> 3] & (1 << (i & 7))) && heightmap[i] < low )
+                low = heightmap[i];
+
+        low = low > 15 ? low - 15 : 0;
+    }
+    else
+        light_heightmap(scratch, heightmap, NULL);
+
+    light_sky(&arrays, scratch, heightmap, low);
+    free(scratch);
+
+    heightmap_list = PyList_New(256);
+    for( i = 0; i < 256; i++ )
+        PyList_SET_ITEM(heightmap_list, i, PyInt_FromLong(heightmap[i]));
+    PyDict_SetItem(level, key_height_map, heightmap_list);
+    Py_DECREF(heightmap_list);
+
+    self->dirty = false;
+    memset(self->dirty_columns, 0, sizeof(self->dirty_columns));
+    self->modified = true;
+
     Py_INCREF(Py_None);
     return Py_None;
 }
 
+/*
+Shrinks the sections that hold few distinct blocks into a palette and packed
+indices, returning the bytes saved.  Sections expand again when written to,
+and are written out in full when the chunk is saved.
+*/
+static PyObject *Chunk_compact( Chunk *self )
+{
+    return PyInt_FromLong(compact_chunk(self));
+}
+
 static PyMemberDef Chunk_members[] = {
     {"world", T_OBJECT, offsetof(Chunk, world), 0, "World the chunk lives in"},
     {"dict", T_OBJECT, offsetof(Chunk, dict), 0, "Chunk attribute dictionary"},
@@ -339,7 +560,10 @@ static PyMemberDef Chunk_members[] = {
 static PyMethodDef Chunk_methods[] = {
     {"save", (PyCFunction) Chunk_save, METH_NOARGS, "Save the chunk to file"},
     {"get_block", (PyCFunction) Chunk_get_block, METH_VARARGS, "Get a block from within the chunk"},
+    {"get_block_raw", (PyCFunction) Chunk_get_block_raw, METH_VARARGS, "Get a block from within the chunk, packed as id | data << 12 | blocklight << 16 | skylight << 20"},
     {"put_block", (PyCFunction) Chunk_put_block, METH_VARARGS, "Put a block into the chunk, at the given location"},
+    {"calculate", (PyCFunction) Chunk_calculate, METH_NOARGS, "Recalculate the chunk's heightmap and skylight"},
+    {"compact", (PyCFunction) Chunk_compact, METH_NOARGS, "Store sections with few distinct blocks as a palette, returning the bytes saved"},
     {NULL}
 };
 
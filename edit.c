@@ -0,0 +1,785 @@
+/*
+edit.c
+
+Bulk edits over boxes of blocks: World.fill, World.replace and World.copy.
+Boxes are split into spans of rows within each chunk section, so whole rows
+(or whole layers, when a box covers a section's full width) are written with
+memset and memcpy rather than one block at a time.  Nibble arrays are worked
+on through the kernels in nibble.c.
+
+Also scattered reads and writes (World.get_blocks and World.put_blocks),
+which group their positions by chunk so each chunk is looked up only once.
+*/
+
+#include <Python.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minecraft.h"
+
+// An inclusive box of block coordinates
+typedef struct {
+    int x1, y1, z1, x2, y2, z2;
+} Box;
+
+static void normalize_box( Box *box )
+{
+    int swap;
+
+    if( box->x1 > box->x2 ) { swap = box->x1; box->x1 = box->x2; box->x2 = swap; }
+    if( box->y1 > box->y2 ) { swap = box->y1; box->y1 = box->y2; box->y2 = swap; }
+    if( box->z1 > box->z2 ) { swap = box->z1; box->z1 = box->z2; box->z2 = swap; }
+}
+
+// The part of box within chunk (cx, cz), in chunk-relative X and Z
+static void chunk_part( Box *box, int cx, int cz, Box *part )
+{
+    part->x1 = box->x1 > cx * 16 ? box->x1 - cx * 16 : 0;
+    part->x2 = box->x2 < cx * 16 + 15 ? box->x2 - cx * 16 : 15;
+    part->z1 = box->z1 > cz * 16 ? box->z1 - cz * 16 : 0;
+    part->z2 = box->z2 < cz * 16 + 15 ? box->z2 - cz * 16 : 15;
+    part->y1 = box->y1;
+    part->y2 = box->y2;
+}
+
+// A section's byte array by name, optionally creating a zeroed nibble array
+static unsigned char *section_array( PyObject *section, PyObject *name, bool create )
+{
+    PyObject *array;
+
+    array = PyDict_GetItem(section, name);
+    if( array == NULL )
+    {
+        if( !create )
+            return NULL;
+
+        array = PyByteArray_FromStringAndSize(NULL, 2048);
+        memset(PyByteArray_AsString(array), 0, 2048);
+        PyDict_SetItem(section, name, array);
+        Py_DECREF(array);
+    }
+
+    return (unsigned char *) PyByteArray_AsString(array);
+}
+
+// Set count nibbles, starting at index start, to value
+static void fill_nibbles( unsigned char *array, int start, int count, int value )
+{
+    int end;
+
+    end = start + count;
+    if( start & 1 )
+    {
+        array[start >> 1] = (array[start >> 1] & 0x0F) | value << 4;
+        start++;
+    }
+    if( end & 1 && end > start )
+    {
+        array[end >> 1] = (array[end >> 1] & 0xF0) | value;
+        end--;
+    }
+    if( end > start )
+        memset(array + (start >> 1), value | value << 4, (end - start) >> 1);
+}
+
+/*
+Fill a box (corners in any order) with a block ID and optional data value.
+Chunks that haven't been generated are skipped.  Returns the number of blocks
+written.
+*/
+PyObject *World_fill( World *self, PyObject *args )
+{
+    Box box;
+    long count;
+    int id, data, cx, cz;
+
+    data = 0;
+    if( !PyArg_ParseTuple(args, "iiiiiii|i", &box.x1, &box.y1, &box.z1, &box.x2, &box.y2, &box.z2, &id, &data) )
+        return NULL;
+
+    if( id < 0 || id > 4095 || data < 0 || data > 15 )
+    {
+        PyErr_Format(PyExc_Exception, "Block ID must be 0-4095 and data 0-15");
+        return NULL;
+    }
+
+    normalize_box(&box);
+    if( box.y1 < 0 )   box.y1 = 0;
+    if( box.y2 > 255 ) box.y2 = 255;
+
+    count = 0;
+    for( cz = box.z1 >> 4; cz <= box.z2 >> 4 && box.y1 <= box.y2; cz++ )
+        for( cx = box.x1 >> 4; cx <= box.x2 >> 4; cx++ )
+        {
+            PyObject *chunk;
+            Box part;
+            int s, width;
+
+            chunk = get_chunk(self, cx, cz);
+            if( chunk == NULL )
+            {
+                PyErr_Clear();
+                continue;
+            }
+
+            chunk_part(&box, cx, cz, &part);
+            width = part.x2 - part.x1 + 1;
+            for( s = part.y1 >> 4; s <= part.y2 >> 4; s++ )
+            {
+                PyObject *section;
+                unsigned char *blocks, *add, *nibbles;
+                int y1, y2, y, z;
+
+                // Air going into a missing section changes nothing
+                section = find_section((Chunk *) chunk, s);
+                if( section == NULL )
+                {
+                    if( id == 0 && data == 0 )
+                        continue;
+                    section = create_section((Chunk *) chunk, s);
+                }
+
+                y1 = s * 16 > part.y1 ? 0 : part.y1 & 15;
+                y2 = s * 16 + 15 < part.y2 ? 15 : part.y2 & 15;
+
+                // A uniform section either already holds the block, or stays
+                // uniform (keeping its light) if the fill covers all of it
+                if( is_uniform(section) )
+                {
+                    unsigned int packed;
+
+                    packed = compact_block_raw(section, 0);
+                    if( (packed & 0xFFFF) == (unsigned int) (id | data << 12) )
+                        continue;
+                    if( width == 16 && part.z1 == 0 && part.z2 == 15 && y1 == 0 && y2 == 15 )
+                    {
+                        make_uniform(section, (packed & ~0xFFFF) | id | data << 12);
+                        continue;
+                    }
+                }
+                expand_section(section);
+
+                blocks = section_array(section, key_blocks, false);
+                nibbles = section_array(section, key_data, true);
+                add = section_array(section, key_add, id >> 8 != 0);
+
+                if( width == 16 && part.z1 == 0 && part.z2 == 15 )
+                {
+                    // Whole layers are contiguous
+                    int start, length;
+
+                    start = y1 * 256;
+                    length = (y2 - y1 + 1) * 256;
+                    memset(blocks + start, id & 0xFF, length);
+                    fill_nibbles(nibbles, start, length, data);
+                    if( add != NULL )
+                        fill_nibbles(add, start, length, id >> 8);
+                }
+                else
+                    for( y = y1; y <= y2; y++ )
+                        for( z = part.z1; z <= part.z2; z++ )
+                        {
+                            int start;
+
+                            start = y * 256 + z * 16 + part.x1;
+                            memset(blocks + start, id & 0xFF, width);
+                            fill_nibbles(nibbles, start, width, data);
+                            if( add != NULL )
+                                fill_nibbles(add, start, width, id >> 8);
+                        }
+            }
+
+            count += (long) width * (part.z2 - part.z1 + 1) * (part.y2 - part.y1 + 1);
+            mark_dirty((Chunk *) chunk, part.x1, part.z1, part.x2, part.z2, part.y1);
+            Py_DECREF(chunk);
+        }
+
+    return PyInt_FromLong(count);
+}
+
+/*
+Replace every block with ID from_id in a box with to_id, also setting its
+data value if to_data is given.  Returns the number of blocks replaced.
+*/
+PyObject *World_replace( World *self, PyObject *args )
+{
+    Box box;
+    unsigned char mask[4096], columns[256];
+    long count;
+    int from_id, to_id, to_data, cx, cz, i;
+    bool partial;
+
+    to_data = -1;
+    if( !PyArg_ParseTuple(args, "iiiiiiii|i", &box.x1, &box.y1, &box.z1, &box.x2, &box.y2, &box.z2, &from_id, &to_id, &to_data) )
+        return NULL;
+
+    if( from_id < 0 || from_id > 4095 || to_id < 0 || to_id > 4095 || to_data > 15 )
+    {
+        PyErr_Format(PyExc_Exception, "Block IDs must be 0-4095 and data 0-15");
+        return NULL;
+    }
+
+    normalize_box(&box);
+    if( box.y1 < 0 )   box.y1 = 0;
+    if( box.y2 > 255 ) box.y2 = 255;
+
+    count = 0;
+    for( cz = box.z1 >> 4; cz <= box.z2 >> 4 && box.y1 <= box.y2; cz++ )
+        for( cx = box.x1 >> 4; cx <= box.x2 >> 4; cx++ )
+        {
+            PyObject *chunk;
+            Box part;
+            long replaced;
+            int s;
+
+            chunk = get_chunk(self, cx, cz);
+            if( chunk == NULL )
+            {
+                PyErr_Clear();
+                continue;
+            }
+
+            chunk_part(&box, cx, cz, &part);
+            partial = part.x1 != 0 || part.x2 != 15 || part.z1 != 0 || part.z2 != 15;
+            for( i = 0; i < 256; i++ )
+                columns[i] = (i & 15) >= part.x1 && (i & 15) <= part.x2 && (i >> 4) >= part.z1 && (i >> 4) <= part.z2 ? 0xFF : 0x00;
+
+            replaced = 0;
+            for( s = part.y1 >> 4; s <= part.y2 >> 4; s++ )
+            {
+                PyObject *section;
+                unsigned char *blocks, *add, *nibbles;
+                int y1, y2, start, length, matches;
+
+                // A missing section is all air
+                section = find_section((Chunk *) chunk, s);
+                if( section == NULL )
+                {
+                    if( from_id != 0 )
+                        continue;
+                    section = create_section((Chunk *) chunk, s);
+                }
+
+                y1 = s * 16 > part.y1 ? 0 : part.y1 & 15;
+                y2 = s * 16 + 15 < part.y2 ? 15 : part.y2 & 15;
+
+                // A uniform section matches everywhere or nowhere, and if the
+                // box covers all of it, stays uniform
+                if( is_uniform(section) )
+                {
+                    unsigned int packed;
+
+                    packed = compact_block_raw(section, 0);
+                    if( (int) (packed & 0xFFF) != from_id )
+                        continue;
+                    if( !partial && y1 == 0 && y2 == 15 )
+                    {
+                        packed = (packed & ~0xFFF) | to_id;
+                        if( to_data >= 0 )
+                            packed = (packed & ~0xF000) | to_data << 12;
+                        make_uniform(section, packed);
+                        replaced += 4096;
+                        continue;
+                    }
+                }
+                expand_section(section);
+
+                blocks = section_array(section, key_blocks, false);
+                nibbles = section_array(section, key_data, true);
+                add = section_array(section, key_add, false);
+
+                // Match whole layers, then mask off the columns outside the box
+                start = y1 * 256;
+                length = (y2 - y1 + 1) * 256;
+                matches = match_ids(blocks + start, add == NULL ? NULL : add + start / 2, from_id, mask, length);
+                if( partial && matches > 0 )
+                {
+                    matches = 0;
+                    for( i = 0; i < length; i++ )
+                    {
+                        mask[i] &= columns[i & 255];
+                        matches += mask[i] & 1;
+                    }
+                }
+                if( matches == 0 )
+                    continue;
+
+                if( add == NULL && to_id >> 8 != 0 )
+                    add = section_array(section, key_add, true);
+
+                set_bytes_masked(blocks + start, mask, to_id & 0xFF, length);
+                if( add != NULL )
+                    set_nibbles_masked(add + start / 2, mask, to_id >> 8, length);
+                if( to_data >= 0 )
+                    set_nibbles_masked(nibbles + start / 2, mask, to_data, length);
+                replaced += matches;
+            }
+
+            if( replaced > 0 )
+                mark_dirty((Chunk *) chunk, part.x1, part.z1, part.x2, part.z2, part.y1);
+            count += replaced;
+            Py_DECREF(chunk);
+        }
+
+    return PyInt_FromLong(count);
+}
+
+/*
+Copy the blocks (IDs and data values) in a box so that its lowest corner lands
+on (dx, dy, dz).  The source is read in full before anything is written, so
+the two boxes may overlap.  Ungenerated chunks read as air and aren't written
+to.  Returns the number of blocks written.
+*/
+PyObject *World_copy( World *self, PyObject *args )
+{
+    Box box, target;
+    unsigned char *ids, *extra; // Per block: low 8 bits of ID, and Add << 4 | Data
+    unsigned char data_bytes[4096], add_bytes[4096], compact_blocks[4096];
+    long count;
+    int dx, dy, dz, width, height, depth, cx, cz;
+
+    if( !PyArg_ParseTuple(args, "iiiiiiiii", &box.x1, &box.y1, &box.z1, &box.x2, &box.y2, &box.z2, &dx, &dy, &dz) )
+        return NULL;
+
+    normalize_box(&box);
+    if( box.y1 < 0 )   box.y1 = 0;
+    if( box.y2 > 255 ) box.y2 = 255;
+    if( box.y1 > box.y2 )
+        return PyInt_FromLong(0);
+
+    width = box.x2 - box.x1 + 1;
+    height = box.y2 - box.y1 + 1;
+    depth = box.z2 - box.z1 + 1;
+    ids = calloc((size_t) width * height * depth, 1);
+    extra = calloc((size_t) width * height * depth, 1);
+    if( ids == NULL || extra == NULL )
+    {
+        free(ids);
+        free(extra);
+        return PyErr_NoMemory();
+    }
+
+    // Read the source box a row at a time
+    for( cz = box.z1 >> 4; cz <= box.z2 >> 4; cz++ )
+        for( cx = box.x1 >> 4; cx <= box.x2 >> 4; cx++ )
+        {
+            PyObject *chunk;
+            Box part;
+            int s;
+
+            chunk = get_chunk(self, cx, cz);
+            if( chunk == NULL )
+            {
+                PyErr_Clear();
+                continue;
+            }
+
+            chunk_part(&box, cx, cz, &part);
+            for( s = part.y1 >> 4; s <= part.y2 >> 4; s++ )
+            {
+                PyObject *section;
+                unsigned char *blocks, *array;
+                int y, z, length, cell;
+
+                section = find_section((Chunk *) chunk, s);
+                if( section == NULL )
+                    continue;
+
+                // Reading a compact section goes through its palette, rather
+                // than expanding it
+                if( is_uniform(section) )
+                {
+                    unsigned int packed;
+
+                    packed = compact_block_raw(section, 0);
+                    memset(compact_blocks, packed & 0xFF, 4096);
+                    memset(add_bytes, (packed >> 8) & 0x0F, 4096);
+                    memset(data_bytes, (packed >> 12) & 0x0F, 4096);
+                    blocks = compact_blocks;
+                }
+                else if( is_compact(section) )
+                {
+                    for( cell = 0; cell < 4096; cell++ )
+                    {
+                        unsigned int packed;
+
+                        packed = compact_block_raw(section, cell);
+                        compact_blocks[cell] = packed & 0xFF;
+                        add_bytes[cell] = (packed >> 8) & 0x0F;
+                        data_bytes[cell] = (packed >> 12) & 0x0F;
+                    }
+                    blocks = compact_blocks;
+                }
+                else
+                {
+                    blocks = section_array(section, key_blocks, false);
+                    if( (array = section_array(section, key_data, false)) != NULL )
+                        unpack_nibbles(array, data_bytes, 4096);
+                    else
+                        memset(data_bytes, 0, 4096);
+                    if( (array = section_array(section, key_add, false)) != NULL )
+                        unpack_nibbles(array, add_bytes, 4096);
+                    else
+                        memset(add_bytes, 0, 4096);
+                }
+
+                length = part.x2 - part.x1 + 1;
+                for( y = s * 16 > part.y1 ? s * 16 : part.y1; y <= s * 16 + 15 && y <= part.y2; y++ )
+                    for( z = part.z1; z <= part.z2; z++ )
+                    {
+                        int start, index, i;
+
+                        start = (y & 15) * 256 + z * 16 + part.x1;
+                        index = ((y - box.y1) * depth + (cz * 16 + z - box.z1)) * width + (cx * 16 + part.x1 - box.x1);
+                        memcpy(ids + index, blocks + start, length);
+                        for( i = 0; i < length; i++ )
+                            extra[index + i] = add_bytes[start + i] << 4 | data_bytes[start + i];
+                    }
+            }
+
+            Py_DECREF(chunk);
+        }
+
+    // Then write it out at the target
+    target.x1 = dx;
+    target.y1 = dy > 0 ? dy : 0;
+    target.z1 = dz;
+    target.x2 = dx + width - 1;
+    target.y2 = dy + height - 1 < 255 ? dy + height - 1 : 255;
+    target.z2 = dz + depth - 1;
+
+    count = 0;
+    for( cz = target.z1 >> 4; cz <= target.z2 >> 4 && target.y1 <= target.y2; cz++ )
+        for( cx = target.x1 >> 4; cx <= target.x2 >> 4; cx++ )
+        {
+            PyObject *chunk;
+            Box part;
+            int s, length;
+
+            chunk = get_chunk(self, cx, cz);
+            if( chunk == NULL )
+            {
+                PyErr_Clear();
+                continue;
+            }
+
+            chunk_part(&target, cx, cz, &part);
+            length = part.x2 - part.x1 + 1;
+            for( s = part.y1 >> 4; s <= part.y2 >> 4; s++ )
+            {
+                PyObject *section;
+                unsigned char *blocks, *add, *nibbles;
+                int y, z;
+                bool written;
+
+                section = get_section((Chunk *) chunk, s, false);
+                blocks = add = nibbles = NULL;
+                if( section != NULL )
+                {
+                    blocks = section_array(section, key_blocks, false);
+                    nibbles = section_array(section, key_data, true);
+                    add = section_array(section, key_add, false);
+                    unpack_nibbles(nibbles, data_bytes, 4096);
+                }
+                if( add != NULL )
+                    unpack_nibbles(add, add_bytes, 4096);
+                else
+                    memset(add_bytes, 0, 4096);
+                written = false;
+
+                for( y = s * 16 > part.y1 ? s * 16 : part.y1; y <= s * 16 + 15 && y <= part.y2; y++ )
+                    for( z = part.z1; z <= part.z2; z++ )
+                    {
+                        int start, index, i;
+                        bool air, high;
+
+                        start = (y & 15) * 256 + z * 16 + part.x1;
+                        index = ((y - dy) * depth + (cz * 16 + z - dz)) * width + (cx * 16 + part.x1 - dx);
+
+                        air = true;
+                        high = false;
+                        for( i = 0; i < length; i++ )
+                        {
+                            if( ids[index + i] != 0 || extra[index + i] != 0 )
+                                air = false;
+                            if( extra[index + i] >> 4 != 0 )
+                                high = true;
+                        }
+
+                        // Only create sections (and Add arrays) that will hold something
+                        if( section == NULL )
+                        {
+                            if( air )
+                                continue;
+
+                            section = get_section((Chunk *) chunk, s, true);
+                            blocks = section_array(section, key_blocks, false);
+                            nibbles = section_array(section, key_data, true);
+                            memset(data_bytes, 0, 4096);
+                        }
+                        if( add == NULL && high )
+                            add = section_array(section, key_add, true);
+
+                        memcpy(blocks + start, ids + index, length);
+                        for( i = 0; i < length; i++ )
+                        {
+                            data_bytes[start + i] = extra[index + i] & 0x0F;
+                            add_bytes[start + i] = extra[index + i] >> 4;
+                        }
+                        written = true;
+                    }
+
+                if( written )
+                {
+                    pack_nibbles(data_bytes, nibbles, 4096);
+                    if( add != NULL )
+                        pack_nibbles(add_bytes, add, 4096);
+                }
+            }
+
+            count += (long) length * (part.z2 - part.z1 + 1) * (part.y2 - part.y1 + 1);
+            mark_dirty((Chunk *) chunk, part.x1, part.z1, part.x2, part.z2, part.y1);
+            Py_DECREF(chunk);
+        }
+
+    free(extra);
+    free(ids);
+
+    return PyInt_FromLong(count);
+}
+
+// A position from a coordinate buffer, tagged with its chunk
+typedef struct {
+    int cx, cz, index;
+} ChunkOrder;
+
+static int compare_order( const void *a, const void *b )
+{
+    const ChunkOrder *first, *second;
+
+    first = (const ChunkOrder *) a;
+    second = (const ChunkOrder *) b;
+    if( first->cx != second->cx )
+        return first->cx < second->cx ? -1 : 1;
+    if( first->cz != second->cz )
+        return first->cz < second->cz ? -1 : 1;
+
+    // Keep positions in their original order within a chunk, so the last
+    // write to a repeated position wins
+    return first->index - second->index;
+}
+
+// Sort positions by chunk, returning a malloc'd array of count entries
+static ChunkOrder *order_by_chunk( const int *coords, int count )
+{
+    ChunkOrder *order;
+    int i;
+
+    order = malloc(sizeof(ChunkOrder) * (count > 0 ? count : 1));
+    for( i = 0; i < count; i++ )
+    {
+        order[i].cx = coords[i * 3] >> 4;
+        order[i].cz = coords[i * 3 + 2] >> 4;
+        order[i].index = i;
+    }
+    qsort(order, count, sizeof(ChunkOrder), compare_order);
+
+    return order;
+}
+
+// Parse an Nx3 buffer of int32 (x, y, z) coordinates
+static const int *parse_coords( PyObject *buffer, int *count )
+{
+    const char *coords;
+    Py_ssize_t length;
+
+    if( PyObject_AsReadBuffer(buffer, (const void **) &coords, &length) != 0 )
+        return NULL;
+
+    if( length % (3 * sizeof(int)) != 0 )
+    {
+        PyErr_Format(PyExc_Exception, "Coordinates must be a buffer of int32 (x, y, z) triples");
+        return NULL;
+    }
+
+    *count = length / (3 * sizeof(int));
+    return (const int *) coords;
+}
+
+/*
+Look up many blocks at once.  coords is a buffer of int32 (x, y, z) triples,
+and the result is a bytearray holding one uint32 per position, packed as for
+get_block_raw, with anything outside the world reading as 0.
+*/
+PyObject *World_get_blocks( World *self, PyObject *args )
+{
+    PyObject *buffer, *result;
+    ChunkOrder *order;
+    const int *coords;
+    unsigned int *out;
+    int count, i;
+
+    if( !PyArg_ParseTuple(args, "O", &buffer) )
+        return NULL;
+    if( (coords = parse_coords(buffer, &count)) == NULL )
+        return NULL;
+
+    result = PyByteArray_FromStringAndSize(NULL, count * sizeof(unsigned int));
+    out = (unsigned int *) PyByteArray_AsString(result);
+    memset(out, 0, count * sizeof(unsigned int));
+
+    order = order_by_chunk(coords, count);
+    for( i = 0; i < count; )
+    {
+        PyObject *chunk, *compact[16];
+        ChunkArrays arrays;
+        int end;
+
+        for( end = i; end < count && order[end].cx == order[i].cx && order[end].cz == order[i].cz; end++ );
+
+        // Reads go through the palette of compact sections, rather than
+        // expanding them
+        chunk = get_chunk(self, order[i].cx, order[i].cz);
+        if( chunk == NULL || read_chunk_arrays((Chunk *) chunk, &arrays, compact) != 0 )
+        {
+            PyErr_Clear();
+            Py_XDECREF(chunk);
+            i = end;
+            continue;
+        }
+
+        for( ; i < end; i++ )
+        {
+            const int *position;
+            int s, cell, id, data, blocklight, skylight;
+
+            position = coords + order[i].index * 3;
+            if( position[1] < 0 || position[1] > 255 )
+                continue;
+
+            s = position[1] >> 4;
+            cell = (position[1] & 15) * 256 + (position[2] & 15) * 16 + (position[0] & 15);
+            if( compact[s] != NULL )
+            {
+                out[order[i].index] = compact_block_raw(compact[s], cell);
+                continue;
+            }
+            if( arrays.blocks[s] == NULL )
+                continue;
+
+            id = arrays.blocks[s][cell];
+            data = blocklight = skylight = 0;
+            if( arrays.add[s] != NULL )
+                id |= get_nibble((char *) arrays.add[s], cell) << 8;
+            if( arrays.data[s] != NULL )
+                data = get_nibble((char *) arrays.data[s], cell);
+            if( arrays.blocklight[s] != NULL )
+                blocklight = get_nibble((char *) arrays.blocklight[s], cell);
+            if( arrays.skylight[s] != NULL )
+                skylight = get_nibble((char *) arrays.skylight[s], cell);
+
+            out[order[i].index] = PACK_BLOCK(id, data, blocklight, skylight);
+        }
+
+        Py_DECREF(chunk);
+    }
+
+    free(order);
+    return result;
+}
+
+/*
+Put many blocks at once.  coords is a buffer of int32 (x, y, z) triples, and
+values a buffer of uint32 packed as for get_block_raw, one per position.
+Positions in chunks that don't exist, or outside 0-255 in Y, are skipped.
+Returns the number of blocks written.
+*/
+PyObject *World_put_blocks( World *self, PyObject *args )
+{
+    PyObject *buffer, *value_buffer;
+    ChunkOrder *order;
+    const unsigned int *values;
+    const int *coords;
+    Py_ssize_t length;
+    long written;
+    int count, i;
+
+    if( !PyArg_ParseTuple(args, "OO", &buffer, &value_buffer) )
+        return NULL;
+    if( (coords = parse_coords(buffer, &count)) == NULL )
+        return NULL;
+    if( PyObject_AsReadBuffer(value_buffer, (const void **) &values, &length) != 0 )
+        return NULL;
+    if( length != count * sizeof(unsigned int) )
+    {
+        PyErr_Format(PyExc_Exception, "Need one uint32 value per position (%d positions, %d values)", count, (int) (length / sizeof(unsigned int)));
+        return NULL;
+    }
+
+    written = 0;
+    order = order_by_chunk(coords, count);
+    for( i = 0; i < count; )
+    {
+        PyObject *chunk;
+        ChunkArrays arrays;
+        int end;
+
+        for( end = i; end < count && order[end].cx == order[i].cx && order[end].cz == order[i].cz; end++ );
+
+        chunk = get_chunk(self, order[i].cx, order[i].cz);
+        if( chunk == NULL || get_chunk_arrays((Chunk *) chunk, &arrays) != 0 )
+        {
+            PyErr_Clear();
+            Py_XDECREF(chunk);
+            i = end;
+            continue;
+        }
+
+        for( ; i < end; i++ )
+        {
+            const int *position;
+            unsigned int value;
+            int x, y, z, s, cell;
+
+            position = coords + order[i].index * 3;
+            value = values[order[i].index];
+            x = position[0] & 15;
+            y = position[1];
+            z = position[2] & 15;
+            if( y < 0 || y > 255 )
+                continue;
+
+            // Create whatever storage the block needs, then refresh the arrays
+            s = y >> 4;
+            if( arrays.blocks[s] == NULL )
+            {
+                create_section((Chunk *) chunk, s);
+                get_chunk_arrays((Chunk *) chunk, &arrays);
+            }
+            if( arrays.add[s] == NULL && (value & 0xF00) != 0 )
+            {
+                section_array(get_section((Chunk *) chunk, s, false), key_add, true);
+                get_chunk_arrays((Chunk *) chunk, &arrays);
+            }
+
+            cell = (y & 15) * 256 + z * 16 + x;
+            arrays.blocks[s][cell] = value & 0xFF;
+            if( arrays.add[s] != NULL )
+                set_nibble((char *) arrays.add[s], cell, (value >> 8) & 0x0F);
+            if( arrays.data[s] != NULL )
+                set_nibble((char *) arrays.data[s], cell, (value >> 12) & 0x0F);
+            if( arrays.blocklight[s] != NULL )
+                set_nibble((char *) arrays.blocklight[s], cell, (value >> 16) & 0x0F);
+            if( arrays.skylight[s] != NULL )
+                set_nibble((char *) arrays.skylight[s], cell, (value >> 20) & 0x0F);
+
+            mark_dirty((Chunk *) chunk, x, z, x, z, y);
+            written++;
+        }
+
+        Py_DECREF(chunk);
+    }
+
+    free(order);
+    return PyInt_FromLong(written);
+}
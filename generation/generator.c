@@ -15,173 +15,397 @@ Some code is derived from sources referenced on the wiki "Generator" write-up
 #include <structmember.h>
 #include "../minecraft.h"
 
-#define PERMUTATIONS      256
-
-float grad[12][3] = {
-    {1.0, 1.0, 0.0}, {-1.0, 1.0, 0.0}, {1.0, -1.0, 0.0}, {-1.0, -1.0, 0.0},
-    {1.0, 0.0, 1.0}, {-1.0, 0.0, 1.0}, {1.0, 0.0, -1.0}, {-1.0, 0.0, -1.0},
-    {0.0, 1.0, 1.0}, {0.0, -1.0, 1.0}, {0.0, 1.0, -1.0}, {0.0, -1.0, -1.0}
-};
-
 typedef struct Generator {
     PyObject_HEAD
-    int * perm;
+    int * perm; // MAX_OCTAVES tables, the first being the base noise table
     int seed;
 } Generator;
 
-// Helper function to calculate a dot product
-float dot( float g[], float x, float y, float z )
+/*
+int main()
 {
-    return g[0] * x + g[1] + y + g[2] * z;
+    Generator * g;
+    float noise_value;
+    int i, seed;
+
+    seed = 123;
+    g = setup(seed);
+    
+    for( i = 0; i < 100000; i++ )
+    {
+        noise_value = noise3(g->perm, (float) i, 0, 14);
+//        printf("Noise value: %f\n", noise_value);
+    }
+
+    //Test permutation table generation
+    
+    for(int i = 0; i < PERMUTATIONS * 2; i++)
+    {
+        printf("%d, ", g->perm[i]);
+    }
 }
+*/
+
+/*
 
-float noise( Generator * g, int x, int y, int z )
+Python
+
+*/
+PyObject * Generator_noise( Generator *self, PyObject *args )
 {
-    float n0, n1, n2, n3, F3, G3, s, t, x0, y0, z0, X0, Y0, Z0, x1, y1, z1, x2, y2, z2, x3, y3, z3, t0, t1, t2, t3;
-    int i, j, k, i1, j1, k1, i2, j2, k2, ii, jj, kk, g0, g1, g2, g3;
-
-    // Skew the input space to determine which simplex cell we're in
-    F3 = 1.0 / 3.0;
-    s = (x + y + z) * F3;
-    i = x + s;
-    j = y + s;
-    k = z + s;
-
-    // Unskew
-    G3 = 1.0 / 6.0;
-    t = (i + j + k) * G3;
-    X0 = i - t;
-    Y0 = j - t;
-    Z0 = k - t;
-    x0 = x - X0;
-    y0 = y - Y0;
-    z0 = z - Z0;
-
-    // Simplexes are, in the 3D case, tetrahedrons, so we want to determine
-    // which one we are in
-    if(x0 >= y0)
+    float x, y, z;
+
+    if( !PyArg_ParseTuple(args, "fff", &x, &y, &z) )
     {
-        if(y0 >= z0)      { i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 1; k2 = 0; }
-        else if(x0 >= z0) { i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 0; k2 = 1; }
-        else              { i1 = 0; j1 = 0; k1 = 1; i2 = 1; j2 = 0; k2 = 1; }
+        PyErr_Format(PyExc_Exception, "Unable to parse arguments.");
+        return NULL;
     }
-    else
+
+    return PyFloat_FromDouble((double) noise3(self->perm, x, y, z));
+}
+
+/*
+Fill a writable buffer (bytearray, array('f'), ...) with float32 noise values
+for a width x height x depth grid starting at (x, y, z), ordered X fastest,
+then Z, then Y
+*/
+PyObject * Generator_noise_grid( Generator *self, PyObject *args )
+{
+    char *buffer;
+    float x, y, z, scale;
+    int buffer_size, width, height, depth;
+
+    scale = 1.0;
+    if( !PyArg_ParseTuple(args, "w#fffiii|f", &buffer, &buffer_size, &x, &y, &z, &width, &height, &depth, &scale) )
     {
-        if(y0 < z0)       { i1 = 0; j1 = 0; k1 = 1; i2 = 0; j2 = 1; k2 = 1; }
-        else if(x0 < z0)  { i1 = 0; j1 = 1; k1 = 0; i2 = 0; j2 = 1; k2 = 1; }
-        else              { i1 = 0; j1 = 1; k1 = 0; i2 = 1; j2 = 1; k2 = 0; }
+        PyErr_Format(PyExc_Exception, "Unable to parse arguments.");
+        return NULL;
     }
 
-    // Calculate offsets for the three other corners of the simplex in XYZ
-    x1 = x0 - i1 + G3;        // Second corner
-    y1 = y0 - j1 + G3; 
-    z1 = z0 - k1 + G3;
-    x2 = x0 - i2 + 2.0 * G3;  // Third
-    y2 = y0 - j2 + 2.0 * G3;
-    z2 = z0 - k2 + 2.0 * G3;
-    x3 = x0 - 1.0 + 3.0 * G3; // Fourth
-    y3 = y0 - 1.0 + 3.0 * G3;
-    z3 = z0 - 1.0 + 3.0 * G3;
-
-    // Determine the corners' gradient indices
-    ii = i & 0xFF;
-    jj = j & 0xFF;
-    kk = k & 0xFF;
-    
-    // Determine the corners' gradient values
-    g0 = g->perm[ii + g->perm[jj + g->perm[kk]]] % 12;
-    g1 = g->perm[ii + i1 + g->perm[jj + j1 + g->perm[kk + k1]]] % 12;
-    g2 = g->perm[ii + i2 + g->perm[jj + j2 + g->perm[kk + k2]]] % 12;
-    g3 = g->perm[ii + 1 + g->perm[jj + 1 + g->perm[kk + 1]]] % 12;
-
-    // printf("Gradients: %d %d %d %d\n", g0, g1, g2, g3);
-
-    // Calculate the contribution from each of the four corners
-    t0 = 0.5 - x0 * x0 - y0 * y0 - z0 * z0;
-    if(t0 < 0)
-        n0 = 0.0;
-    else
+    if( width <= 0 || height <= 0 || depth <= 0 )
+    {
+        PyErr_Format(PyExc_Exception, "Grid dimensions must be positive");
+        return NULL;
+    }
+
+    if( (long) buffer_size < (long) width * height * depth * (long) sizeof(float) )
     {
-        t0 *= t0;
-        n0 = t0 * t0 * dot(grad[g0], x0, y0, z0);
+        PyErr_Format(PyExc_Exception, "Buffer too small for a %dx%dx%d grid", width, height, depth);
+        return NULL;
     }
 
-    t1 = 0.5 - x1 * x1 - y1 * y1 - z1 * z1;
-    if(t1 < 0)
-        n1 = 0.0;
-    else
+    noise3_grid(self->perm, (float *) buffer, x, y, z, width, height, depth, scale);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyObject * Generator_noise2( Generator *self, PyObject *args )
+{
+    float x, z;
+
+    if( !PyArg_ParseTuple(args, "ff", &x, &z) )
     {
-        t1 *= t1;
-        n1 = t1 * t1 * dot(grad[g1], x1, y1, z1);
+        PyErr_Format(PyExc_Exception, "Unable to parse arguments.");
+        return NULL;
     }
 
-    t2 = 0.5 - x2 * x2 - y2 * y2 - z2 * z2;
-    if(t2 < 0)
-        n2 = 0.0;
-    else
+    return PyFloat_FromDouble((double) noise2(self->perm, x, z));
+}
+
+/*
+Fill a writable buffer with float32 2D noise values for a width x depth grid
+starting at (x, z), X varying fastest
+*/
+PyObject * Generator_noise2_grid( Generator *self, PyObject *args )
+{
+    char *buffer;
+    float x, z, scale;
+    int buffer_size, width, depth;
+
+    scale = 1.0;
+    if( !PyArg_ParseTuple(args, "w#ffii|f", &buffer, &buffer_size, &x, &z, &width, &depth, &scale) )
     {
-        t2 *= t2;
-        n2 = t2 * t2 * dot(grad[g2], x2, y2, z2);
+        PyErr_Format(PyExc_Exception, "Unable to parse arguments.");
+        return NULL;
+    }
+
+    if( width <= 0 || depth <= 0 )
+    {
+        PyErr_Format(PyExc_Exception, "Grid dimensions must be positive");
+        return NULL;
     }
 
-    t3 = 0.5 - x3 * x3 - y3 * y3 - z3 * z3;
-    if(t3 < 0)
-        n3 = 0.0;
-    else
+    if( (long) buffer_size < (long) width * depth * (long) sizeof(float) )
     {
-        t3 *= t3;
-        n3 = t3 * t3 * dot(grad[g3], x3, y3, z3);
+        PyErr_Format(PyExc_Exception, "Buffer too small for a %dx%d grid", width, depth);
+        return NULL;
     }
 
-    // Return summed corner noise contributions
-    // TODO: Unscaled for now
-    return 16 * (n0 + n1 + n2 + n3);
+    noise2_grid(self->perm, (float *) buffer, x, z, width, depth, scale);
+
+    Py_INCREF(Py_None);
+    return Py_None;
 }
 
 /*
-int main()
+Evaluate noise at an arbitrary set of points, given as a buffer of float32
+x, y, z triplets, writing one float32 per point to the output buffer
+*/
+PyObject * Generator_noise_points( Generator *self, PyObject *args )
 {
-    Generator * g;
-    float noise_value;
-    int i, seed;
+    const char *coords;
+    char *buffer;
+    int coords_size, buffer_size, count;
 
-    seed = 123;
-    g = setup(seed);
-    
-    for( i = 0; i < 100000; i++ )
+    if( !PyArg_ParseTuple(args, "s#w#", &coords, &coords_size, &buffer, &buffer_size) )
     {
-        noise_value = noise(g, (float) i, 0, 14);
-//        printf("Noise value: %f\n", noise_value);
+        PyErr_Format(PyExc_Exception, "Unable to parse arguments.");
+        return NULL;
     }
 
-    //Test permutation table generation
-    
-    for(int i = 0; i < PERMUTATIONS * 2; i++)
+    count = coords_size / (3 * sizeof(float));
+    if( buffer_size < count * (int) sizeof(float) )
     {
-        printf("%d, ", g->perm[i]);
+        PyErr_Format(PyExc_Exception, "Buffer too small for %d points", count);
+        return NULL;
+    }
+
+    noise3_points(self->perm, (float *) buffer, (const float *) coords, count);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Validate the optional fractal arguments shared by the octave methods
+static int check_fractal( Fractal *fractal )
+{
+    if( fractal->octaves < 1 || fractal->octaves > MAX_OCTAVES )
+    {
+        PyErr_Format(PyExc_Exception, "Octaves must be between 1 and %d", MAX_OCTAVES);
+        return -1;
     }
+
+    return 0;
 }
+
+/*
+Fill a float32 buffer with fractal noise over a 3D grid, laid out like
+noise_grid.  Optional arguments, in order: octaves (4), frequency (1.0),
+amplitude (1.0), lacunarity (2.0) and persistence (0.5)
 */
+PyObject * Generator_octave_noise_grid( Generator *self, PyObject *args )
+{
+    Fractal fractal = {4, 1.0, 1.0, 2.0, 0.5};
+    char *buffer;
+    float x, y, z;
+    int buffer_size, width, height, depth;
+
+    if( !PyArg_ParseTuple(args, "w#fffiii|iffff", &buffer, &buffer_size, &x, &y, &z, &width, &height, &depth,
+                          &fractal.octaves, &fractal.frequency, &fractal.amplitude, &fractal.lacunarity, &fractal.persistence) )
+    {
+        PyErr_Format(PyExc_Exception, "Unable to parse arguments.");
+        return NULL;
+    }
+
+    if( check_fractal(&fractal) != 0 )
+        return NULL;
+
+    if( width <= 0 || height <= 0 || depth <= 0 )
+    {
+        PyErr_Format(PyExc_Exception, "Grid dimensions must be positive");
+        return NULL;
+    }
+
+    if( (long) buffer_size < (long) width * height * depth * (long) sizeof(float) )
+    {
+        PyErr_Format(PyExc_Exception, "Buffer too small for a %dx%dx%d grid", width, height, depth);
+        return NULL;
+    }
+
+    fbm3_grid(self->perm, &fractal, (float *) buffer, x, y, z, width, height, depth);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
 
 /*
+Fill a float32 buffer with a width x depth fractal noise heightmap, X varying
+fastest.  Takes the same optional arguments as octave_noise_grid
+*/
+PyObject * Generator_octave_noise_heightmap( Generator *self, PyObject *args )
+{
+    Fractal fractal = {4, 1.0, 1.0, 2.0, 0.5};
+    char *buffer;
+    float x, z;
+    int buffer_size, width, depth;
 
-Python
+    if( !PyArg_ParseTuple(args, "w#ffii|iffff", &buffer, &buffer_size, &x, &z, &width, &depth,
+                          &fractal.octaves, &fractal.frequency, &fractal.amplitude, &fractal.lacunarity, &fractal.persistence) )
+    {
+        PyErr_Format(PyExc_Exception, "Unable to parse arguments.");
+        return NULL;
+    }
+
+    if( check_fractal(&fractal) != 0 )
+        return NULL;
+
+    if( width <= 0 || depth <= 0 )
+    {
+        PyErr_Format(PyExc_Exception, "Grid dimensions must be positive");
+        return NULL;
+    }
+
+    if( (long) buffer_size < (long) width * depth * (long) sizeof(float) )
+    {
+        PyErr_Format(PyExc_Exception, "Buffer too small for a %dx%d heightmap", width, depth);
+        return NULL;
+    }
+
+    fbm2_grid(self->perm, &fractal, (float *) buffer, x, z, width, depth);
 
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/*
+Read terrain tunables out of an optional parameter dictionary, leaving the
+defaults in place for any key that isn't present
 */
-PyObject * Generator_noise( Generator *self, PyObject *args )
+static int parse_terrain_params( PyObject *dict, TerrainParams *params )
 {
-    PyObject *output;
-    float x, y, z;
+    PyObject *value;
 
-    if( !PyArg_ParseTuple(args, "fff", &x, &y, &z) )
+    default_terrain_params(params);
+    if( dict == NULL || dict == Py_None )
+        return 0;
+
+    if( !PyDict_Check(dict) )
+    {
+        PyErr_Format(PyExc_Exception, "Terrain parameters must be a dictionary");
+        return -1;
+    }
+
+    if( (value = PyDict_GetItemString(dict, "octaves")) != NULL )
+        params->height.octaves = PyInt_AsLong(value);
+    if( (value = PyDict_GetItemString(dict, "frequency")) != NULL )
+        params->height.frequency = PyFloat_AsDouble(value);
+    if( (value = PyDict_GetItemString(dict, "amplitude")) != NULL )
+        params->height.amplitude = PyFloat_AsDouble(value);
+    if( (value = PyDict_GetItemString(dict, "lacunarity")) != NULL )
+        params->height.lacunarity = PyFloat_AsDouble(value);
+    if( (value = PyDict_GetItemString(dict, "persistence")) != NULL )
+        params->height.persistence = PyFloat_AsDouble(value);
+    if( (value = PyDict_GetItemString(dict, "base_height")) != NULL )
+        params->base_height = PyInt_AsLong(value);
+    if( (value = PyDict_GetItemString(dict, "sea_level")) != NULL )
+        params->sea_level = PyInt_AsLong(value);
+    if( (value = PyDict_GetItemString(dict, "dirt_depth")) != NULL )
+        params->dirt_depth = PyInt_AsLong(value);
+    if( (value = PyDict_GetItemString(dict, "biome")) != NULL )
+        params->biome = PyInt_AsLong(value);
+    if( (value = PyDict_GetItemString(dict, "cave_frequency")) != NULL )
+        params->cave_frequency = PyFloat_AsDouble(value);
+    if( (value = PyDict_GetItemString(dict, "cave_threshold")) != NULL )
+        params->cave_threshold = PyFloat_AsDouble(value);
+
+    if( PyErr_Occurred() )
+        return -1;
+
+    return check_fractal(&params->height);
+}
+
+/*
+Generate the chunk at (cx, cz) in C and hand it to the world as a Chunk,
+replacing any chunk already held there.  The chunk is returned, and is
+written to its region by Chunk.save() or World.save_region(...).
+
+Recognised parameters (all optional): octaves, frequency, amplitude,
+lacunarity and persistence of the heightmap noise, base_height, sea_level,
+dirt_depth, biome, and cave_frequency / cave_threshold (caves are carved
+where 3D noise exceeds the threshold; 0 disables them).
+*/
+PyObject * Generator_generate_chunk( Generator *self, PyObject *args )
+{
+    PyObject *world, *dict, *params;
+    GeneratedChunk *generated;
+    TerrainParams terrain;
+    Chunk *chunk;
+    int cx, cz;
+
+    params = NULL;
+    if( !PyArg_ParseTuple(args, "O!ii|O", &minecraft_WorldType, &world, &cx, &cz, &params) )
+    {
+        PyErr_Format(PyExc_Exception, "Unable to parse arguments.");
+        return NULL;
+    }
+
+    if( parse_terrain_params(params, &terrain) != 0 )
+        return NULL;
+
+    generated = malloc(sizeof(GeneratedChunk));
+    generate_column(self->perm, &terrain, cx, cz, generated);
+    dict = generated_chunk_to_dict(generated, cx, cz);
+    free(generated);
+
+    // Built directly rather than through Chunk_init, since there's nothing
+    // to read from the region file
+    chunk = (Chunk *) minecraft_ChunkType.tp_alloc(&minecraft_ChunkType, 0);
+    chunk->x = cx;
+    chunk->z = cz;
+    chunk->dict = dict;
+    Py_INCREF(world);
+    chunk->world = world;
+    chunk->modified = true;
+
+    put_chunk((World *) world, (PyObject *) chunk);
+
+    return (PyObject *) chunk;
+}
+
+/*
+Generate every region in bounds, given as (rx1, rz1, rx2, rz2) inclusive, into
+the world directory at world_path, spreading whole regions across threads.
+Region files are written directly, bypassing any World object, and come out
+byte-identical whatever the thread count.  params is as for generate_chunk.
+*/
+PyObject * Generator_generate_area( Generator *self, PyObject *args, PyObject *kwds )
+{
+    static char *kwlist[] = {"world_path", "region_bounds", "threads", "params", NULL};
+    PyObject *params;
+    TerrainParams terrain;
+    char *path;
+    int rx1, rz1, rx2, rz2, threads, failed;
+
+    params = NULL;
+    threads = 1;
+    if( !PyArg_ParseTupleAndKeywords(args, kwds, "s(iiii)|iO", kwlist, &path, &rx1, &rz1, &rx2, &rz2, &threads, &params) )
     {
         PyErr_Format(PyExc_Exception, "Unable to parse arguments.");
         return NULL;
     }
 
-    output = PyFloat_FromDouble((double) noise(self, x, y, z));
-    Py_INCREF(output);
-    return output;
+    if( rx2 < rx1 || rz2 < rz1 || threads < 1 )
+    {
+        PyErr_Format(PyExc_Exception, "Invalid region bounds or thread count");
+        return NULL;
+    }
+
+    if( parse_terrain_params(params, &terrain) != 0 )
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    failed = generate_area(self->perm, &terrain, path, rx1, rz1, rx2, rz2, threads);
+    Py_END_ALLOW_THREADS
+
+    if( failed != 0 )
+    {
+        PyErr_Format(PyExc_Exception, "Unable to write %d region file(s) to %s/region", failed, path);
+        return NULL;
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
 }
 
 void Generator_dealloc( Generator *self )
@@ -199,25 +423,12 @@ int Generator_init( Generator *self, PyObject *args, PyObject *kwds )
 
     self->seed = seed;
 
-    // Generate the permutations table, doubled to avoid more work when indices wrap
-    self->perm = calloc(sizeof(int), PERMUTATIONS * 2);
-    for( i = PERMUTATIONS - 1; i >= 0; i-- )
-    {
-        int value, position;
-
-        position = seed % PERMUTATIONS;
-        value = self->perm[position];
-        while(value > i) {
-            position++;
-            if(position > PERMUTATIONS - 1)
-                position = 0;
-            value = self->perm[position];
-        }
-        
-        seed += i * 17;
-        self->perm[position] = i;
-        self->perm[position + PERMUTATIONS] = i;
-    }
+    // Generate the permutations tables, doubled to avoid more work when indices
+    // wrap.  Every octave gets its own table, precomputed here so the octave
+    // noise calls don't pay for it
+    self->perm = calloc(sizeof(int), PERMUTATIONS * 2 * MAX_OCTAVES);
+    for( i = 0; i < MAX_OCTAVES; i++ )
+        build_permutations(self->perm + i * PERMUTATIONS * 2, seed + i * OCTAVE_SEED_STEP);
 
     return 0;
 }
@@ -229,6 +440,14 @@ static PyMemberDef Generator_members[] = {
 
 static PyMethodDef Generator_methods[] = {
     {"noise", (PyCFunction) Generator_noise, METH_VARARGS, "Get the noise strength at a particular point in three dimensional space."},
+    {"noise_grid", (PyCFunction) Generator_noise_grid, METH_VARARGS, "Fill a float32 buffer with noise over a 3D grid of points."},
+    {"noise_points", (PyCFunction) Generator_noise_points, METH_VARARGS, "Fill a float32 buffer with noise at each of a buffer of x, y, z points."},
+    {"noise2", (PyCFunction) Generator_noise2, METH_VARARGS, "Get the 2D noise strength at a particular (x, z) point."},
+    {"noise2_grid", (PyCFunction) Generator_noise2_grid, METH_VARARGS, "Fill a float32 buffer with 2D noise over a grid of points."},
+    {"octave_noise_grid", (PyCFunction) Generator_octave_noise_grid, METH_VARARGS, "Fill a float32 buffer with fractal noise over a 3D grid of points."},
+    {"octave_noise_heightmap", (PyCFunction) Generator_octave_noise_heightmap, METH_VARARGS, "Fill a float32 buffer with a 2D fractal noise heightmap."},
+    {"generate_chunk", (PyCFunction) Generator_generate_chunk, METH_VARARGS, "Generate terrain for a chunk of a world, given its chunk coordinates and an optional parameter dictionary."},
+    {"generate_area", (PyCFunction) Generator_generate_area, METH_VARARGS | METH_KEYWORDS, "Generate whole regions of a world directory in parallel, given inclusive region bounds."},
     {NULL}
 };
 
@@ -0,0 +1,538 @@
+/*
+noise.c
+
+Simplex noise kernels used by the Generator.  Everything in here works on a
+bare permutation table rather than a Python object, so the kernels can be
+driven from anywhere (batch fills, chunk generation, worker threads).
+
+When SSE2 is available (always the case on x86-64) the batch functions
+evaluate four points at a time, falling back to the scalar path for any
+remainder, or entirely on other architectures.  Both paths perform the same
+float operations in the same order, so they produce identical results.
+*/
+
+#include <Python.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../minecraft.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define F2  0.36602540378f // (sqrt(3) - 1) / 2
+#define G2  0.21132486540f // (3 - sqrt(3)) / 6
+#define F3  (1.0f / 3.0f)
+#define G3  (1.0f / 6.0f)
+
+// Two dimensional gradients: the four diagonals plus the four axes
+static const float grad2[8][2] = {
+    {1.0, 1.0}, {-1.0, 1.0}, {1.0, -1.0}, {-1.0, -1.0},
+    {1.0, 0.0}, {-1.0, 0.0}, {0.0, 1.0}, {0.0, -1.0}
+};
+
+static const float grad3[12][3] = {
+    {1.0, 1.0, 0.0}, {-1.0, 1.0, 0.0}, {1.0, -1.0, 0.0}, {-1.0, -1.0, 0.0},
+    {1.0, 0.0, 1.0}, {-1.0, 0.0, 1.0}, {1.0, 0.0, -1.0}, {-1.0, 0.0, -1.0},
+    {0.0, 1.0, 1.0}, {0.0, -1.0, 1.0}, {0.0, 1.0, -1.0}, {0.0, -1.0, -1.0}
+};
+
+/*
+Fills a permutation table (PERMUTATIONS * 2 entries, the second half mirroring
+the first so indices can wrap without masking) from a seed
+*/
+void build_permutations( int *perm, int seed )
+{
+    int i;
+
+    memset(perm, 0, sizeof(int) * PERMUTATIONS * 2);
+    for( i = PERMUTATIONS - 1; i >= 0; i-- )
+    {
+        int value, position;
+
+        position = seed % PERMUTATIONS;
+        if( position < 0 )
+            position += PERMUTATIONS;
+        value = perm[position];
+        while(value > i) {
+            position++;
+            if(position > PERMUTATIONS - 1)
+                position = 0;
+            value = perm[position];
+        }
+
+        seed += i * 17;
+        perm[position] = i;
+        perm[position + PERMUTATIONS] = i;
+    }
+}
+
+static inline int fastfloor( float x )
+{
+    int xi = (int) x;
+    return x < xi ? xi - 1 : xi;
+}
+
+// Helper function to calculate a dot product
+static inline float dot( const float g[], float x, float y, float z )
+{
+    return g[0] * x + g[1] * y + g[2] * z;
+}
+
+// Contribution of a single simplex corner
+static inline float corner( int gi, float x, float y, float z )
+{
+    float t;
+
+    t = 0.5f - x * x - y * y - z * z;
+    if( t < 0 )
+        return 0.0f;
+
+    t *= t;
+    return t * t * dot(grad3[gi], x, y, z);
+}
+
+float noise3( int *perm, float x, float y, float z )
+{
+    float s, t, x0, y0, z0, X0, Y0, Z0, x1, y1, z1, x2, y2, z2, x3, y3, z3;
+    int i, j, k, i1, j1, k1, i2, j2, k2, ii, jj, kk, g0, g1, g2, g3;
+
+    // Skew the input space to determine which simplex cell we're in
+    s = (x + y + z) * F3;
+    i = fastfloor(x + s);
+    j = fastfloor(y + s);
+    k = fastfloor(z + s);
+
+    // Unskew
+    t = (float) (i + j + k) * G3;
+    X0 = i - t;
+    Y0 = j - t;
+    Z0 = k - t;
+    x0 = x - X0;
+    y0 = y - Y0;
+    z0 = z - Z0;
+
+    // Simplexes are, in the 3D case, tetrahedrons, so we want to determine
+    // which one we are in
+    if(x0 >= y0)
+    {
+        if(y0 >= z0)      { i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 1; k2 = 0; }
+        else if(x0 >= z0) { i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 0; k2 = 1; }
+        else              { i1 = 0; j1 = 0; k1 = 1; i2 = 1; j2 = 0; k2 = 1; }
+    }
+    else
+    {
+        if(y0 < z0)       { i1 = 0; j1 = 0; k1 = 1; i2 = 0; j2 = 1; k2 = 1; }
+        else if(x0 < z0)  { i1 = 0; j1 = 1; k1 = 0; i2 = 0; j2 = 1; k2 = 1; }
+        else              { i1 = 0; j1 = 1; k1 = 0; i2 = 1; j2 = 1; k2 = 0; }
+    }
+
+    // Calculate offsets for the three other corners of the simplex in XYZ
+    x1 = x0 - i1 + G3;                // Second corner
+    y1 = y0 - j1 + G3;
+    z1 = z0 - k1 + G3;
+    x2 = x0 - i2 + 2.0f * G3;         // Third
+    y2 = y0 - j2 + 2.0f * G3;
+    z2 = z0 - k2 + 2.0f * G3;
+    x3 = x0 - 1.0f + 3.0f * G3;       // Fourth
+    y3 = y0 - 1.0f + 3.0f * G3;
+    z3 = z0 - 1.0f + 3.0f * G3;
+
+    // Determine the corners' gradient indices
+    ii = i & 0xFF;
+    jj = j & 0xFF;
+    kk = k & 0xFF;
+
+    g0 = perm[ii + perm[jj + perm[kk]]] % 12;
+    g1 = perm[ii + i1 + perm[jj + j1 + perm[kk + k1]]] % 12;
+    g2 = perm[ii + i2 + perm[jj + j2 + perm[kk + k2]]] % 12;
+    g3 = perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] % 12;
+
+    // Return summed corner noise contributions
+    // TODO: Unscaled for now
+    return 16 * (corner(g0, x0, y0, z0) + corner(g1, x1, y1, z1) +
+                 corner(g2, x2, y2, z2) + corner(g3, x3, y3, z3));
+}
+
+// Contribution of a single corner of a 2D simplex (triangle)
+static inline float corner2( int gi, float x, float y )
+{
+    float t;
+
+    t = 0.5f - x * x - y * y;
+    if( t < 0 )
+        return 0.0f;
+
+    t *= t;
+    return t * t * (grad2[gi][0] * x + grad2[gi][1] * y);
+}
+
+/*
+Two dimensional simplex noise, for heightmaps and anything else that doesn't
+need a third axis.  Only three corners and a single comparison are needed to
+pick the triangle, so this is a good deal cheaper than noise3.  Scaled to
+roughly [-1, 1].
+*/
+float noise2( int *perm, float x, float y )
+{
+    float s, t, x0, y0, x1, y1, x2, y2;
+    int i, j, i1, j1, ii, jj, g0, g1, g2;
+
+    // Skew to find the containing cell, then unskew back to XY
+    s = (x + y) * F2;
+    i = fastfloor(x + s);
+    j = fastfloor(y + s);
+    t = (float) (i + j) * G2;
+    x0 = x - (i - t);
+    y0 = y - (j - t);
+
+    // Lower or upper triangle of the cell
+    if( x0 > y0 ) { i1 = 1; j1 = 0; }
+    else          { i1 = 0; j1 = 1; }
+
+    x1 = x0 - i1 + G2;
+    y1 = y0 - j1 + G2;
+    x2 = x0 - 1.0f + 2.0f * G2;
+    y2 = y0 - 1.0f + 2.0f * G2;
+
+    ii = i & 0xFF;
+    jj = j & 0xFF;
+    g0 = perm[ii + perm[jj]] & 7;
+    g1 = perm[ii + i1 + perm[jj + j1]] & 7;
+    g2 = perm[ii + 1 + perm[jj + 1]] & 7;
+
+    return 70 * (corner2(g0, x0, y0) + corner2(g1, x1, y1) + corner2(g2, x2, y2));
+}
+
+#if defined(__SSE2__)
+
+static inline __m128 floor4( __m128 v )
+{
+    __m128 t;
+
+    t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmplt_ps(v, t), _mm_set1_ps(1.0f)));
+}
+
+static inline __m128 corner4( __m128 x, __m128 y, __m128 z, const int *gi )
+{
+    __m128 t, gx, gy, gz;
+
+    gx = _mm_setr_ps(grad3[gi[0]][0], grad3[gi[1]][0], grad3[gi[2]][0], grad3[gi[3]][0]);
+    gy = _mm_setr_ps(grad3[gi[0]][1], grad3[gi[1]][1], grad3[gi[2]][1], grad3[gi[3]][1]);
+    gz = _mm_setr_ps(grad3[gi[0]][2], grad3[gi[1]][2], grad3[gi[2]][2], grad3[gi[3]][2]);
+
+    t = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_set1_ps(0.5f), _mm_mul_ps(x, x)), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+    t = _mm_max_ps(t, _mm_setzero_ps());
+    t = _mm_mul_ps(t, t);
+    t = _mm_mul_ps(t, t);
+
+    return _mm_mul_ps(t, _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, x), _mm_mul_ps(gy, y)), _mm_mul_ps(gz, z)));
+}
+
+// Four-wide version of noise3, see above for the annotated scalar algorithm
+static __m128 noise3_4( int *perm, __m128 x, __m128 y, __m128 z )
+{
+    __m128 s, t, fi, fj, fk, x0, y0, z0, xy, xz, yz, i1, j1, k1, i2, j2, k2, one, ones, n;
+    int ii[4], jj[4], kk[4], o1[3][4], o2[3][4], g[4][4], lane;
+
+    one = _mm_set1_ps(1.0f);
+    ones = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+    s = _mm_mul_ps(_mm_add_ps(_mm_add_ps(x, y), z), _mm_set1_ps(F3));
+    fi = floor4(_mm_add_ps(x, s));
+    fj = floor4(_mm_add_ps(y, s));
+    fk = floor4(_mm_add_ps(z, s));
+
+    t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(fi, fj), fk), _mm_set1_ps(G3));
+    x0 = _mm_sub_ps(x, _mm_sub_ps(fi, t));
+    y0 = _mm_sub_ps(y, _mm_sub_ps(fj, t));
+    z0 = _mm_sub_ps(z, _mm_sub_ps(fk, t));
+
+    // The scalar tetrahedron selection, expressed as comparison masks
+    xy = _mm_cmpge_ps(x0, y0);
+    xz = _mm_cmpge_ps(x0, z0);
+    yz = _mm_cmpge_ps(y0, z0);
+    i1 = _mm_and_ps(xy, xz);
+    j1 = _mm_andnot_ps(xy, yz);
+    k1 = _mm_andnot_ps(_mm_or_ps(i1, j1), ones);
+    i2 = _mm_or_ps(xy, xz);
+    j2 = _mm_or_ps(_mm_andnot_ps(xy, ones), yz);
+    k2 = _mm_andnot_ps(_mm_and_ps(i2, j2), ones);
+
+    // Gradient selection needs table lookups, which are done per lane
+    _mm_storeu_si128((__m128i *) ii, _mm_and_si128(_mm_cvttps_epi32(fi), _mm_set1_epi32(0xFF)));
+    _mm_storeu_si128((__m128i *) jj, _mm_and_si128(_mm_cvttps_epi32(fj), _mm_set1_epi32(0xFF)));
+    _mm_storeu_si128((__m128i *) kk, _mm_and_si128(_mm_cvttps_epi32(fk), _mm_set1_epi32(0xFF)));
+    _mm_storeu_si128((__m128i *) o1[0], _mm_and_si128(_mm_castps_si128(i1), _mm_set1_epi32(1)));
+    _mm_storeu_si128((__m128i *) o1[1], _mm_and_si128(_mm_castps_si128(j1), _mm_set1_epi32(1)));
+    _mm_storeu_si128((__m128i *) o1[2], _mm_and_si128(_mm_castps_si128(k1), _mm_set1_epi32(1)));
+    _mm_storeu_si128((__m128i *) o2[0], _mm_and_si128(_mm_castps_si128(i2), _mm_set1_epi32(1)));
+    _mm_storeu_si128((__m128i *) o2[1], _mm_and_si128(_mm_castps_si128(j2), _mm_set1_epi32(1)));
+    _mm_storeu_si128((__m128i *) o2[2], _mm_and_si128(_mm_castps_si128(k2), _mm_set1_epi32(1)));
+
+    for( lane = 0; lane < 4; lane++ )
+    {
+        int a, b, c;
+
+        a = ii[lane];
+        b = jj[lane];
+        c = kk[lane];
+        g[0][lane] = perm[a + perm[b + perm[c]]] % 12;
+        g[1][lane] = perm[a + o1[0][lane] + perm[b + o1[1][lane] + perm[c + o1[2][lane]]]] % 12;
+        g[2][lane] = perm[a + o2[0][lane] + perm[b + o2[1][lane] + perm[c + o2[2][lane]]]] % 12;
+        g[3][lane] = perm[a + 1 + perm[b + 1 + perm[c + 1]]] % 12;
+    }
+
+    n = corner4(x0, y0, z0, g[0]);
+    n = _mm_add_ps(n, corner4(_mm_add_ps(_mm_sub_ps(x0, _mm_and_ps(i1, one)), _mm_set1_ps(G3)),
+                              _mm_add_ps(_mm_sub_ps(y0, _mm_and_ps(j1, one)), _mm_set1_ps(G3)),
+                              _mm_add_ps(_mm_sub_ps(z0, _mm_and_ps(k1, one)), _mm_set1_ps(G3)), g[1]));
+    n = _mm_add_ps(n, corner4(_mm_add_ps(_mm_sub_ps(x0, _mm_and_ps(i2, one)), _mm_set1_ps(2.0f * G3)),
+                              _mm_add_ps(_mm_sub_ps(y0, _mm_and_ps(j2, one)), _mm_set1_ps(2.0f * G3)),
+                              _mm_add_ps(_mm_sub_ps(z0, _mm_and_ps(k2, one)), _mm_set1_ps(2.0f * G3)), g[2]));
+    n = _mm_add_ps(n, corner4(_mm_add_ps(_mm_sub_ps(x0, one), _mm_set1_ps(3.0f * G3)),
+                              _mm_add_ps(_mm_sub_ps(y0, one), _mm_set1_ps(3.0f * G3)),
+                              _mm_add_ps(_mm_sub_ps(z0, one), _mm_set1_ps(3.0f * G3)), g[3]));
+
+    return _mm_mul_ps(_mm_set1_ps(16.0f), n);
+}
+
+static inline __m128 corner2_4( __m128 x, __m128 y, const int *gi )
+{
+    __m128 t, gx, gy;
+
+    gx = _mm_setr_ps(grad2[gi[0]][0], grad2[gi[1]][0], grad2[gi[2]][0], grad2[gi[3]][0]);
+    gy = _mm_setr_ps(grad2[gi[0]][1], grad2[gi[1]][1], grad2[gi[2]][1], grad2[gi[3]][1]);
+
+    t = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(0.5f), _mm_mul_ps(x, x)), _mm_mul_ps(y, y));
+    t = _mm_max_ps(t, _mm_setzero_ps());
+    t = _mm_mul_ps(t, t);
+    t = _mm_mul_ps(t, t);
+
+    return _mm_mul_ps(t, _mm_add_ps(_mm_mul_ps(gx, x), _mm_mul_ps(gy, y)));
+}
+
+// Four-wide version of noise2
+static __m128 noise2_4( int *perm, __m128 x, __m128 y )
+{
+    __m128 s, t, fi, fj, x0, y0, i1, j1, one, n;
+    int ii[4], jj[4], o1[4], g[3][4], lane;
+
+    one = _mm_set1_ps(1.0f);
+
+    s = _mm_mul_ps(_mm_add_ps(x, y), _mm_set1_ps(F2));
+    fi = floor4(_mm_add_ps(x, s));
+    fj = floor4(_mm_add_ps(y, s));
+    t = _mm_mul_ps(_mm_add_ps(fi, fj), _mm_set1_ps(G2));
+    x0 = _mm_sub_ps(x, _mm_sub_ps(fi, t));
+    y0 = _mm_sub_ps(y, _mm_sub_ps(fj, t));
+
+    i1 = _mm_and_ps(_mm_cmpgt_ps(x0, y0), one);
+    j1 = _mm_sub_ps(one, i1);
+
+    _mm_storeu_si128((__m128i *) ii, _mm_and_si128(_mm_cvttps_epi32(fi), _mm_set1_epi32(0xFF)));
+    _mm_storeu_si128((__m128i *) jj, _mm_and_si128(_mm_cvttps_epi32(fj), _mm_set1_epi32(0xFF)));
+    _mm_storeu_si128((__m128i *) o1, _mm_cvttps_epi32(i1));
+
+    for( lane = 0; lane < 4; lane++ )
+    {
+        int a, b;
+
+        a = ii[lane];
+        b = jj[lane];
+        g[0][lane] = perm[a + perm[b]] & 7;
+        g[1][lane] = perm[a + o1[lane] + perm[b + 1 - o1[lane]]] & 7;
+        g[2][lane] = perm[a + 1 + perm[b + 1]] & 7;
+    }
+
+    n = corner2_4(x0, y0, g[0]);
+    n = _mm_add_ps(n, corner2_4(_mm_add_ps(_mm_sub_ps(x0, i1), _mm_set1_ps(G2)),
+                                _mm_add_ps(_mm_sub_ps(y0, j1), _mm_set1_ps(G2)), g[1]));
+    n = _mm_add_ps(n, corner2_4(_mm_add_ps(_mm_sub_ps(x0, one), _mm_set1_ps(2.0f * G2)),
+                                _mm_add_ps(_mm_sub_ps(y0, one), _mm_set1_ps(2.0f * G2)), g[2]));
+
+    return _mm_mul_ps(_mm_set1_ps(70.0f), n);
+}
+
+#endif
+
+/*
+Adds amplitude-scaled noise for count points along the X axis to out, starting
+at (x, y, z) and advancing step units in X for every point
+*/
+void noise3_row( int *perm, float *out, int count, float x, float y, float z, float step, float amplitude )
+{
+    int i;
+
+    i = 0;
+#if defined(__SSE2__)
+    {
+        __m128 vx, vy, vz, vstep, vamp, lanes;
+
+        vx = _mm_set1_ps(x);
+        vy = _mm_set1_ps(y);
+        vz = _mm_set1_ps(z);
+        vstep = _mm_set1_ps(step);
+        vamp = _mm_set1_ps(amplitude);
+        lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+        for( ; i + 4 <= count; i += 4 )
+        {
+            __m128 px, n;
+
+            px = _mm_add_ps(vx, _mm_mul_ps(vstep, _mm_add_ps(_mm_set1_ps((float) i), lanes)));
+            n = noise3_4(perm, px, vy, vz);
+            _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(vamp, n)));
+        }
+    }
+#endif
+    for( ; i < count; i++ )
+        out[i] += amplitude * noise3(perm, x + step * (float) i, y, z);
+}
+
+/*
+Fills out with noise sampled over a width x height x depth grid of points,
+starting at (x, y, z) and spaced scale units apart.  The output is ordered
+with X varying fastest, then Z, then Y, matching the layout of a chunk
+section:
+    out[(j * depth + k) * width + i] = noise((x + i) * scale, (y + j) * scale, (z + k) * scale)
+*/
+void noise3_grid( int *perm, float *out, float x, float y, float z, int width, int height, int depth, float scale )
+{
+    int j, k;
+
+    memset(out, 0, sizeof(float) * width * height * depth);
+    for( j = 0; j < height; j++ )
+        for( k = 0; k < depth; k++ )
+            noise3_row(perm, out + (j * depth + k) * width, width,
+                       x * scale, (y + j) * scale, (z + k) * scale, scale, 1.0f);
+}
+
+/*
+Evaluates noise at count arbitrary points, with coords holding interleaved
+x, y, z triplets
+*/
+void noise3_points( int *perm, float *out, const float *coords, int count )
+{
+    int i;
+
+    i = 0;
+#if defined(__SSE2__)
+    for( ; i + 4 <= count; i += 4 )
+    {
+        const float *c;
+
+        c = coords + i * 3;
+        _mm_storeu_ps(out + i, noise3_4(perm,
+                                        _mm_setr_ps(c[0], c[3], c[6], c[9]),
+                                        _mm_setr_ps(c[1], c[4], c[7], c[10]),
+                                        _mm_setr_ps(c[2], c[5], c[8], c[11])));
+    }
+#endif
+    for( ; i < count; i++ )
+        out[i] = noise3(perm, coords[i * 3], coords[i * 3 + 1], coords[i * 3 + 2]);
+}
+
+/*
+Two dimensional counterpart of noise3_row, advancing step units in X from
+(x, y) for each of count points
+*/
+void noise2_row( int *perm, float *out, int count, float x, float y, float step, float amplitude )
+{
+    int i;
+
+    i = 0;
+#if defined(__SSE2__)
+    {
+        __m128 vx, vy, vstep, vamp, lanes;
+
+        vx = _mm_set1_ps(x);
+        vy = _mm_set1_ps(y);
+        vstep = _mm_set1_ps(step);
+        vamp = _mm_set1_ps(amplitude);
+        lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+        for( ; i + 4 <= count; i += 4 )
+        {
+            __m128 px, n;
+
+            px = _mm_add_ps(vx, _mm_mul_ps(vstep, _mm_add_ps(_mm_set1_ps((float) i), lanes)));
+            n = noise2_4(perm, px, vy);
+            _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(vamp, n)));
+        }
+    }
+#endif
+    for( ; i < count; i++ )
+        out[i] += amplitude * noise2(perm, x + step * (float) i, y);
+}
+
+/*
+Fills out with 2D noise over a width x depth grid starting at (x, z), ordered
+X fastest:
+    out[k * width + i] = noise2((x + i) * scale, (z + k) * scale)
+*/
+void noise2_grid( int *perm, float *out, float x, float z, int width, int depth, float scale )
+{
+    int k;
+
+    memset(out, 0, sizeof(float) * width * depth);
+    for( k = 0; k < depth; k++ )
+        noise2_row(perm, out + k * width, width, x * scale, (z + k) * scale, scale, 1.0f);
+}
+
+/*
+Fractal (fBm) noise.  perms holds one permutation table per octave, laid out
+back to back (PERMUTATIONS * 2 ints apart), so every octave samples an
+independent noise field.  Each row is accumulated octave by octave while it
+is still in cache.
+*/
+void fbm3_grid( int *perms, Fractal *fractal, float *out, float x, float y, float z, int width, int height, int depth )
+{
+    int j, k, o;
+
+    memset(out, 0, sizeof(float) * width * height * depth);
+    for( j = 0; j < height; j++ )
+        for( k = 0; k < depth; k++ )
+        {
+            float frequency, amplitude, *row;
+
+            row = out + (j * depth + k) * width;
+            frequency = fractal->frequency;
+            amplitude = fractal->amplitude;
+            for( o = 0; o < fractal->octaves; o++ )
+            {
+                noise3_row(perms + o * PERMUTATIONS * 2, row, width,
+                           x * frequency, (y + j) * frequency, (z + k) * frequency, frequency, amplitude);
+                frequency *= fractal->lacunarity;
+                amplitude *= fractal->persistence;
+            }
+        }
+}
+
+/*
+Two dimensional fBm over a width x depth grid, ordered X fastest, as used for
+heightmaps
+*/
+void fbm2_grid( int *perms, Fractal *fractal, float *out, float x, float z, int width, int depth )
+{
+    int k, o;
+
+    memset(out, 0, sizeof(float) * width * depth);
+    for( k = 0; k < depth; k++ )
+    {
+        float frequency, amplitude, *row;
+
+        row = out + k * width;
+        frequency = fractal->frequency;
+        amplitude = fractal->amplitude;
+        for( o = 0; o < fractal->octaves; o++ )
+        {
+            noise2_row(perms + o * PERMUTATIONS * 2, row, width,
+                       x * frequency, (z + k) * frequency, frequency, amplitude);
+            frequency *= fractal->lacunarity;
+            amplitude *= fractal->persistence;
+        }
+    }
+}
@@ -0,0 +1,449 @@
+/*
+terrain.c
+
+Native terrain generation.  A chunk column is generated entirely in C into a
+GeneratedChunk (flat section arrays, heightmap and biomes), which can then be
+turned into the NBT dictionary a Chunk holds, or written straight out as NBT
+when whole regions are generated in parallel.
+*/
+
+#include <Python.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "../minecraft.h"
+#include "../tags.h"
+#include "../stats.h"
+#include "zlib.h"
+
+#define BEDROCK     7
+#define STONE       1
+#define DIRT        3
+#define GRASS       2
+#define WATER       9
+
+void default_terrain_params( TerrainParams *params )
+{
+    params->height.octaves = 6;
+    params->height.frequency = 1.0 / 256.0;
+    params->height.amplitude = 24.0;
+    params->height.lacunarity = 2.0;
+    params->height.persistence = 0.5;
+    params->base_height = 64;
+    params->sea_level = 62;
+    params->dirt_depth = 4;
+    params->biome = 1; // Plains
+    params->cave_frequency = 1.0 / 32.0;
+    params->cave_threshold = 0.0; // Disabled
+}
+
+/*
+Generate the chunk column at (cx, cz) into out.  perms holds MAX_OCTAVES
+permutation tables, as kept by the Generator; the heightmap is fractal 2D
+noise, and caves (if enabled) carve stone wherever 3D noise from the last
+table exceeds the threshold.
+*/
+void generate_column( int *perms, TerrainParams *params, int cx, int cz, GeneratedChunk *out )
+{
+    float heights[256], *density;
+    int i, y, top, max_height;
+
+    memset(out, 0, sizeof(GeneratedChunk));
+    memset(out->biomes, params->biome, sizeof(out->biomes));
+
+    fbm2_grid(perms, &params->height, heights, cx * 16, cz * 16, 16, 16);
+
+    max_height = 1;
+    for( i = 0; i < 256; i++ )
+    {
+        int height;
+
+        height = params->base_height + (int) heights[i];
+        if( height < 1 )
+            height = 1;
+        else if( height > 255 )
+            height = 255;
+
+        out->heightmap[i] = height;
+        if( height > max_height )
+            max_height = height;
+    }
+
+    density = NULL;
+    if( params->cave_threshold > 0 )
+    {
+        density = malloc(sizeof(float) * 256 * max_height);
+        noise3_grid(perms + (MAX_OCTAVES - 1) * PERMUTATIONS * 2, density,
+                    cx * 16, 0, cz * 16, 16, max_height, 16, params->cave_frequency);
+    }
+
+    // Layer each column: bedrock, stone, dirt, then grass (or dirt, if the
+    // surface ends up underwater), with water filled up to sea level
+    for( i = 0; i < 256; i++ )
+    {
+        int height;
+
+        height = out->heightmap[i];
+        for( y = 0; y < 256; y++ )
+        {
+            unsigned char id;
+
+            if( y == 0 )
+                id = BEDROCK;
+            else if( y < height - params->dirt_depth )
+                id = STONE;
+            else if( y < height - 1 )
+                id = DIRT;
+            else if( y == height - 1 )
+                id = height - 1 >= params->sea_level ? GRASS : DIRT;
+            else if( y < params->sea_level )
+                id = WATER;
+            else
+                break;
+
+            if( density != NULL && y > 0 && y < height && density[y * 256 + i] > params->cave_threshold )
+                id = 0;
+
+            out->blocks[y >> 4][(y & 15) * 256 + i] = id;
+        }
+
+        // The game's heightmap is the first block with full skylight, which
+        // water (being partly opaque) also counts towards
+        if( height < params->sea_level )
+            out->heightmap[i] = params->sea_level;
+    }
+    free(density);
+
+    // Sections up to the highest block are written out; anything above the
+    // heightmap gets full skylight, the rest is left for relighting
+    top = max_height > params->sea_level ? max_height : params->sea_level;
+    out->sections = (top + 15) / 16;
+    for( i = 0; i < 256; i++ )
+        for( y = out->heightmap[i]; y < out->sections * 16; y++ )
+        {
+            int position;
+
+            position = (y & 15) * 256 + i;
+            out->skylight[y >> 4][position / 2] |= position % 2 == 0 ? 0x0F : 0xF0;
+        }
+}
+
+/*
+Build the NBT dictionary for a generated chunk, in the same shape get_tag
+produces when reading a chunk from a region file
+*/
+PyObject *generated_chunk_to_dict( GeneratedChunk *chunk, int cx, int cz )
+{
+    PyObject *root, *level, *sections, *heightmap, *value;
+    int i;
+
+    level = PyDict_New();
+
+    value = PyInt_FromLong(cx);
+    PyDict_SetItem(level, key_x_pos, value);
+    Py_DECREF(value);
+    value = PyInt_FromLong(cz);
+    PyDict_SetItem(level, key_z_pos, value);
+    Py_DECREF(value);
+    value = PyInt_FromLong(0);
+    PyDict_SetItem(level, key_last_update, value);
+    Py_DECREF(value);
+    value = PyInt_FromLong(1);
+    PyDict_SetItem(level, key_terrain_populated, value);
+    Py_DECREF(value);
+
+    value = PyByteArray_FromStringAndSize((char *) chunk->biomes, 256);
+    PyDict_SetItem(level, key_biomes, value);
+    Py_DECREF(value);
+
+    heightmap = PyList_New(256);
+    for( i = 0; i < 256; i++ )
+        PyList_SET_ITEM(heightmap, i, PyInt_FromLong(chunk->heightmap[i]));
+    PyDict_SetItem(level, key_height_map, heightmap);
+    Py_DECREF(heightmap);
+
+    sections = PyList_New(chunk->sections);
+    for( i = 0; i < chunk->sections; i++ )
+    {
+        PyObject *section;
+
+        section = PyDict_New();
+
+        value = PyInt_FromLong(i);
+        PyDict_SetItem(section, key_y, value);
+        Py_DECREF(value);
+        value = PyByteArray_FromStringAndSize((char *) chunk->blocks[i], 4096);
+        PyDict_SetItem(section, key_blocks, value);
+        Py_DECREF(value);
+        value = PyByteArray_FromStringAndSize((char *) chunk->data[i], 2048);
+        PyDict_SetItem(section, key_data, value);
+        Py_DECREF(value);
+        value = PyByteArray_FromStringAndSize((char *) chunk->blocklight[i], 2048);
+        PyDict_SetItem(section, key_block_light, value);
+        Py_DECREF(value);
+        value = PyByteArray_FromStringAndSize((char *) chunk->skylight[i], 2048);
+        PyDict_SetItem(section, key_sky_light, value);
+        Py_DECREF(value);
+
+        PyList_SET_ITEM(sections, i, section);
+    }
+    PyDict_SetItem(level, key_sections, sections);
+    Py_DECREF(sections);
+
+    value = PyList_New(0);
+    PyDict_SetItem(level, key_entities, value);
+    Py_DECREF(value);
+    value = PyList_New(0);
+    PyDict_SetItem(level, key_tile_entities, value);
+    Py_DECREF(value);
+
+    root = PyDict_New();
+    PyDict_SetItem(root, key_level, level);
+    Py_DECREF(level);
+
+    return root;
+}
+
+/*
+Region-parallel generation.  Whole regions are handed out to worker threads,
+each of which generates its 1024 chunks, writes them as NBT, compresses them
+and writes the region file on its own, without touching any Python objects.
+A region's bytes depend only on the seed, parameters and its coordinates, so
+the output is identical whatever the thread count.
+*/
+
+typedef struct {
+    int *perms;
+    TerrainParams *params;
+    char *path;
+    int rx1, rz1, width, count;
+    volatile int next, failed;
+} AreaJob;
+
+static unsigned char *nbt_header( unsigned char *dst, unsigned char id, const char *name )
+{
+    int length;
+
+    length = strlen(name);
+    dst[0] = id;
+    dst[1] = length >> 8;
+    dst[2] = length & 0xFF;
+    memcpy(dst + 3, name, length);
+    return dst + 3 + length;
+}
+
+static unsigned char *nbt_int( unsigned char *dst, int value )
+{
+    dst[0] = (value >> 24) & 0xFF;
+    dst[1] = (value >> 16) & 0xFF;
+    dst[2] = (value >> 8) & 0xFF;
+    dst[3] = value & 0xFF;
+    return dst + 4;
+}
+
+static unsigned char *nbt_byte_array( unsigned char *dst, const char *name, unsigned char *array, int size )
+{
+    dst = nbt_header(dst, TAG_BYTE_ARRAY, name);
+    dst = nbt_int(dst, size);
+    memcpy(dst, array, size);
+    return dst + size;
+}
+
+/*
+Write a generated chunk out as uncompressed NBT, in the same layout that
+generated_chunk_to_dict followed by write_tags describes.  dst must hold
+at least GENERATED_NBT_MAX bytes.  Returns the number of bytes written.
+*/
+int generated_chunk_to_nbt( GeneratedChunk *chunk, int cx, int cz, unsigned char *dst )
+{
+    unsigned char *start;
+    int i;
+
+    start = dst;
+    dst = nbt_header(dst, TAG_COMPOUND, "");
+    dst = nbt_header(dst, TAG_COMPOUND, "Level");
+
+    dst = nbt_int(nbt_header(dst, TAG_INT, "xPos"), cx);
+    dst = nbt_int(nbt_header(dst, TAG_INT, "zPos"), cz);
+    dst = nbt_header(dst, TAG_LONG, "LastUpdate");
+    memset(dst, 0, 8);
+    dst += 8;
+    dst = nbt_header(dst, TAG_BYTE, "TerrainPopulated");
+    *dst++ = 1;
+
+    dst = nbt_byte_array(dst, "Biomes", chunk->biomes, 256);
+    dst = nbt_int(nbt_header(dst, TAG_INT_ARRAY, "HeightMap"), 256);
+    for( i = 0; i < 256; i++ )
+        dst = nbt_int(dst, chunk->heightmap[i]);
+
+    dst = nbt_header(dst, TAG_LIST, "Sections");
+    *dst++ = TAG_COMPOUND;
+    dst = nbt_int(dst, chunk->sections);
+    for( i = 0; i < chunk->sections; i++ )
+    {
+        dst = nbt_header(dst, TAG_BYTE, "Y");
+        *dst++ = i;
+        dst = nbt_byte_array(dst, "Blocks", chunk->blocks[i], 4096);
+        dst = nbt_byte_array(dst, "Data", chunk->data[i], 2048);
+        dst = nbt_byte_array(dst, "BlockLight", chunk->blocklight[i], 2048);
+        dst = nbt_byte_array(dst, "SkyLight", chunk->skylight[i], 2048);
+        *dst++ = TAG_END;
+    }
+
+    // Empty entity lists are written as empty byte array lists, as the game does
+    dst = nbt_header(dst, TAG_LIST, "Entities");
+    *dst++ = TAG_BYTE_ARRAY;
+    dst = nbt_int(dst, 0);
+    dst = nbt_header(dst, TAG_LIST, "TileEntities");
+    *dst++ = TAG_BYTE_ARRAY;
+    dst = nbt_int(dst, 0);
+
+    *dst++ = TAG_END; // Level
+    *dst++ = TAG_END; // Root
+
+    return dst - start;
+}
+
+/*
+Generate region (rx, rz) and write it to path/region/r.x.z.mca.  Scratch
+buffers are supplied by the caller so a worker can reuse them across regions.
+Returns 0 on success, -1 if the file couldn't be written.
+*/
+static int generate_region( int *perms, TerrainParams *params, char *path, int rx, int rz,
+                            GeneratedChunk *generated, unsigned char *nbt, unsigned char *compressed )
+{
+    FILE *fp;
+    unsigned char *region;
+    char filename[1000];
+    int i, size, buffer_size, sector;
+
+    buffer_size = 8192 + 1024 * 4096 * 2;
+    region = calloc(buffer_size, 1);
+    sector = 2;
+
+    for( i = 0; i < 1024; i++ )
+    {
+        unsigned long compressed_size;
+        unsigned long long start;
+        int cx, cz, nbt_size, sectors;
+
+        cx = rx * 32 + (i & 31);
+        cz = rz * 32 + (i >> 5);
+        generate_column(perms, params, cx, cz, generated);
+        nbt_size = generated_chunk_to_nbt(generated, cx, cz, nbt);
+
+        start = stats_clock();
+        compressed_size = compressBound(nbt_size);
+        compress2(compressed, &compressed_size, nbt, nbt_size, Z_DEFAULT_COMPRESSION);
+        STAT_ADD(STAT_DEFLATED_BYTES, nbt_size);
+        STAT_ADD(STAT_ZLIB_NS, stats_clock() - start);
+
+        sectors = (compressed_size + 5 + 4096 - 1) / 4096;
+        if( (sector + sectors) * 4096 > buffer_size )
+        {
+            region = realloc(region, buffer_size * 2);
+            memset(region + buffer_size, 0, buffer_size);
+            buffer_size *= 2;
+        }
+
+        // Location table entry, then the chunk's length and compression type
+        nbt_int(region + i * 4, sector << 8 | sectors);
+        nbt_int(region + sector * 4096, compressed_size + 1);
+        region[sector * 4096 + 4] = 2;
+        memcpy(region + sector * 4096 + 5, compressed, compressed_size);
+
+        sector += sectors;
+    }
+    size = sector * 4096;
+
+    sprintf(filename, "%s/region/r.%d.%d.mca", path, rx, rz);
+    fp = fopen(filename, "wb");
+    if( fp == NULL )
+    {
+        free(region);
+        return -1;
+    }
+
+    fwrite(region, 1, size, fp);
+    fclose(fp);
+    free(region);
+
+    return 0;
+}
+
+static void *area_worker( void *arg )
+{
+    AreaJob *job;
+    GeneratedChunk *generated;
+    unsigned char *nbt, *compressed;
+    int perms[PERMUTATIONS * 2 * MAX_OCTAVES];
+
+    job = (AreaJob *) arg;
+
+    // Every worker gets a private copy of the permutation tables
+    memcpy(perms, job->perms, sizeof(perms));
+    generated = malloc(sizeof(GeneratedChunk));
+    nbt = malloc(GENERATED_NBT_MAX);
+    compressed = malloc(compressBound(GENERATED_NBT_MAX));
+
+    while( true )
+    {
+        int index;
+
+        index = __sync_fetch_and_add(&job->next, 1);
+        if( index >= job->count )
+            break;
+
+        if( generate_region(perms, job->params, job->path,
+                            job->rx1 + index % job->width, job->rz1 + index / job->width,
+                            generated, nbt, compressed) != 0 )
+            __sync_fetch_and_add(&job->failed, 1);
+    }
+
+    free(compressed);
+    free(nbt);
+    free(generated);
+
+    return NULL;
+}
+
+/*
+Generate every region from (rx1, rz1) to (rx2, rz2) inclusive into the world
+at path, using the given number of threads.  Must be called without the GIL
+held, or at least without relying on it.  Returns the number of regions that
+couldn't be written.
+*/
+int generate_area( int *perms, TerrainParams *params, char *path, int rx1, int rz1, int rx2, int rz2, int threads )
+{
+    AreaJob job;
+    pthread_t *workers;
+    char directory[1000];
+    int i;
+
+    sprintf(directory, "%s/region", path);
+    mkdir(directory, 0755);
+
+    job.perms = perms;
+    job.params = params;
+    job.path = path;
+    job.rx1 = rx1;
+    job.rz1 = rz1;
+    job.width = rx2 - rx1 + 1;
+    job.count = job.width * (rz2 - rz1 + 1);
+    job.next = 0;
+    job.failed = 0;
+
+    if( threads > job.count )
+        threads = job.count;
+
+    workers = malloc(sizeof(pthread_t) * threads);
+    for( i = 0; i < threads; i++ )
+        pthread_create(&workers[i], NULL, area_worker, &job);
+    for( i = 0; i < threads; i++ )
+        pthread_join(workers[i], NULL);
+    free(workers);
+
+    return job.failed;
+}
@@ -0,0 +1,281 @@
+/*
+iterator.c
+
+Iterators over what exists in a world, returned by World.iter_regions() and
+World.iter_chunks().  Region files are found by listing the region directory,
+and chunks by reading each region's location table; no chunk is decompressed.
+While the caller works through one region, the kernel is asked to start
+reading the next region file in the background.
+*/
+
+#include <Python.h>
+#include <structmember.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "minecraft.h"
+
+static int compare_regions( const void *a, const void *b )
+{
+    const int *first, *second;
+
+    first = (const int *) a;
+    second = (const int *) b;
+    if( first[1] != second[1] )
+        return first[1] < second[1] ? -1 : 1;
+    return first[0] < second[0] ? -1 : first[0] > second[0];
+}
+
+/*
+List the regions with files in the world's region directory, as malloc'd
+(x, z) pairs sorted by Z and then X.  Returns the number found.
+*/
+static int list_regions( World *world, int **regions )
+{
+    DIR *directory;
+    struct dirent *entry;
+    char path[1000]; // TODO: Dynamic
+    int count, size;
+
+    count = size = 0;
+    *regions = NULL;
+
+    sprintf(path, "%s/region", world->path);
+    directory = opendir(path);
+    if( directory == NULL )
+        return 0;
+
+    while( (entry = readdir(directory)) != NULL )
+    {
+        int x, z, length;
+        char extension[4];
+
+        // Only take names that are exactly r.<x>.<z>.mca
+        if( sscanf(entry->d_name, "r.%d.%d.%3s%n", &x, &z, extension, &length) != 3 ||
+            strcmp(extension, "mca") != 0 || entry->d_name[length] != '\0' )
+            continue;
+
+        if( count == size )
+        {
+            size = size == 0 ? 16 : size * 2;
+            *regions = realloc(*regions, sizeof(int) * 2 * size);
+        }
+        (*regions)[count * 2] = x;
+        (*regions)[count * 2 + 1] = z;
+        count++;
+    }
+    closedir(directory);
+
+    qsort(*regions, count, sizeof(int) * 2, compare_regions);
+    return count;
+}
+
+// Hint to the kernel that a region file will be read soon
+static void advise_region( World *world, int x, int z )
+{
+    char filename[1000]; // TODO: Dynamic
+    int fd;
+
+    sprintf(filename, "%s/region/r.%d.%d.mca", world->path, x, z);
+    fd = open(filename, O_RDONLY);
+    if( fd < 0 )
+        return;
+
+#if defined(POSIX_FADV_WILLNEED)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+    close(fd);
+}
+
+/*
+Read a region's chunk location table.  A region already in memory is read
+from its buffer, which may hold chunks not yet saved.  Returns 0, or -1 if
+the region can't be read.
+*/
+static int read_locations( World *world, int x, int z, unsigned char *locations )
+{
+    Region *region;
+    FILE *fp;
+    char filename[1000]; // TODO: Dynamic
+    size_t size;
+
+    for( region = world->regions; region != NULL; region = region->next )
+        if( region->x == x && region->z == z )
+        {
+            memcpy(locations, region->buffer, 4096);
+            return 0;
+        }
+
+    sprintf(filename, "%s/region/r.%d.%d.mca", world->path, x, z);
+    fp = fopen(filename, "rb");
+    if( fp == NULL )
+        return -1;
+
+    size = fread(locations, 1, 4096, fp);
+    fclose(fp);
+
+    // A short file just has no chunks past its end
+    memset(locations + size, 0, 4096 - size);
+    return 0;
+}
+
+/*
+
+Python object-related code
+
+*/
+static void WorldIterator_dealloc( WorldIterator *self )
+{
+    Py_XDECREF(self->world);
+    free(self->regions);
+    self->ob_type->tp_free((PyObject *) self);
+}
+
+/*
+Create an iterator over the world's regions, or over its chunks if chunks is
+set, limited to chunks within bbox (x1, z1, x2, z2 in chunk coordinates,
+inclusive) if it isn't NULL.
+*/
+PyObject *create_world_iterator( World *world, bool chunks, int *bbox )
+{
+    WorldIterator *iterator;
+    int i, kept;
+
+    iterator = (WorldIterator *) minecraft_WorldIteratorType.tp_alloc(&minecraft_WorldIteratorType, 0);
+    if( iterator == NULL )
+        return NULL;
+
+    Py_INCREF(world);
+    iterator->world = world;
+    iterator->chunks = chunks;
+    iterator->region_count = list_regions(world, &iterator->regions);
+    iterator->region_index = -1;
+    iterator->chunk_index = 1024;
+
+    if( bbox != NULL )
+    {
+        memcpy(iterator->bbox, bbox, sizeof(iterator->bbox));
+        if( iterator->bbox[0] > iterator->bbox[2] ) { i = iterator->bbox[0]; iterator->bbox[0] = iterator->bbox[2]; iterator->bbox[2] = i; }
+        if( iterator->bbox[1] > iterator->bbox[3] ) { i = iterator->bbox[1]; iterator->bbox[1] = iterator->bbox[3]; iterator->bbox[3] = i; }
+        iterator->bounded = true;
+
+        // Drop regions entirely outside the box up front
+        kept = 0;
+        for( i = 0; i < iterator->region_count; i++ )
+        {
+            int x, z;
+
+            x = iterator->regions[i * 2];
+            z = iterator->regions[i * 2 + 1];
+            if( x * 32 + 31 < iterator->bbox[0] || x * 32 > iterator->bbox[2] ||
+                z * 32 + 31 < iterator->bbox[1] || z * 32 > iterator->bbox[3] )
+                continue;
+
+            iterator->regions[kept * 2] = x;
+            iterator->regions[kept * 2 + 1] = z;
+            kept++;
+        }
+        iterator->region_count = kept;
+    }
+
+    return (PyObject *) iterator;
+}
+
+// Move on to the next region, returning false once there are none left
+static bool next_region( WorldIterator *self )
+{
+    self->region_index++;
+    if( self->region_index >= self->region_count )
+        return false;
+
+    if( self->region_index + 1 < self->region_count )
+        advise_region(self->world, self->regions[self->region_index * 2 + 2], self->regions[self->region_index * 2 + 3]);
+
+    return true;
+}
+
+static PyObject *WorldIterator_iternext( WorldIterator *self )
+{
+    if( !self->chunks )
+    {
+        if( !next_region(self) )
+            return NULL;
+
+        return Py_BuildValue("ii", self->regions[self->region_index * 2], self->regions[self->region_index * 2 + 1]);
+    }
+
+    while( true )
+    {
+        // Find the next populated chunk in the current region
+        while( self->chunk_index < 1024 )
+        {
+            unsigned char *location;
+            int x, z;
+
+            location = self->locations + self->chunk_index * 4;
+            x = self->regions[self->region_index * 2] * 32 + (self->chunk_index & 31);
+            z = self->regions[self->region_index * 2 + 1] * 32 + (self->chunk_index >> 5);
+            self->chunk_index++;
+
+            if( swap_endianness(location, 3) == 0 )
+                continue;
+            if( self->bounded && (x < self->bbox[0] || x > self->bbox[2] || z < self->bbox[1] || z > self->bbox[3]) )
+                continue;
+
+            return Py_BuildValue("ii", x, z);
+        }
+
+        if( !next_region(self) )
+            return NULL;
+
+        self->chunk_index = 0;
+        if( read_locations(self->world, self->regions[self->region_index * 2], self->regions[self->region_index * 2 + 1], self->locations) != 0 )
+            self->chunk_index = 1024;
+    }
+}
+
+PyTypeObject minecraft_WorldIteratorType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "minecraft.WorldIterator", /*tp_name*/
+    sizeof(WorldIterator),     /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)WorldIterator_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_ITER, /*tp_flags*/
+    "Iterator over the regions or chunks in a World", /* tp_doc */
+    0,                     /* tp_traverse */
+    0,                     /* tp_clear */
+    0,                     /* tp_richcompare */
+    0,                     /* tp_weaklistoffset */
+    PyObject_SelfIter,         /* tp_iter */
+    (iternextfunc)WorldIterator_iternext, /* tp_iternext */
+    0,                         /* tp_methods */
+    0,                         /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,                         /* tp_init */
+    0,                         /* tp_alloc */
+    0,                         /* tp_new */
+};
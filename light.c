@@ -0,0 +1,920 @@
+/*
+light.c
+
+Lighting engine: heightmaps, skylight and block light.  Light is
+computed on a LightScratch, which holds one byte per block for a whole chunk
+column (indexed y * 256 + z * 16 + x, the same order as section storage), and
+is packed back into the sections' nibble arrays once propagation is done.
+*/
+
+#include <Python.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minecraft.h"
+
+#define QUEUED      0x10 // Set on a scratch light value while it is queued
+#define LIGHT_MASK  0x0F
+
+static unsigned char opacity_table[4096], emission_table[4096];
+static bool tables_ready = false;
+
+// Blocks that let light through, and how much they take away on the way
+static const int transparent_blocks[][2] = {
+    {0, 0}, {6, 0}, {8, 3}, {9, 3}, {18, 1}, {20, 0}, {26, 0}, {27, 0}, {28, 0},
+    {30, 1}, {31, 0}, {32, 0}, {37, 0}, {38, 0}, {39, 0}, {40, 0}, {50, 0}, {51, 0},
+    {52, 0}, {55, 0}, {59, 0}, {63, 0}, {64, 0}, {65, 0}, {66, 0}, {68, 0}, {69, 0},
+    {70, 0}, {71, 0}, {72, 0}, {75, 0}, {76, 0}, {77, 0}, {78, 0}, {79, 3}, {83, 0},
+    {85, 0}, {90, 0}, {92, 0}, {93, 0}, {94, 0}, {96, 0}, {101, 0}, {102, 0},
+    {104, 0}, {105, 0}, {106, 0}, {107, 0}, {111, 0}, {113, 0}, {115, 0}, {117, 0},
+    {118, 0}, {119, 0}, {127, 0}, {131, 0}, {132, 0}, {139, 0}, {140, 0}, {141, 0},
+    {142, 0}, {143, 0}, {144, 0}, {145, 0},
+    {-1, 0} // Sentinel
+};
+
+// Blocks that give off light, and how much
+static const int light_sources[][2] = {
+    {10, 15}, {11, 15}, {50, 14}, {51, 15}, {62, 13}, {74, 9}, {76, 7}, {89, 15},
+    {90, 11}, {91, 15}, {94, 9}, {119, 15}, {120, 1}, {122, 1}, {124, 15}, {130, 7},
+    {138, 15},
+    {-1, 0} // Sentinel
+};
+
+// Must be called (while single threaded) before any of the light functions
+void init_light_tables( void )
+{
+    int i;
+
+    if( tables_ready )
+        return;
+
+    memset(opacity_table, 15, sizeof(opacity_table));
+    for( i = 0; transparent_blocks[i][0] >= 0; i++ )
+        opacity_table[transparent_blocks[i][0]] = transparent_blocks[i][1];
+
+    memset(emission_table, 0, sizeof(emission_table));
+    for( i = 0; light_sources[i][0] >= 0; i++ )
+        emission_table[light_sources[i][0]] = light_sources[i][1];
+
+    tables_ready = true;
+}
+
+unsigned char block_opacity( int id )
+{
+    return opacity_table[id & 0xFFF];
+}
+
+unsigned char block_emission( int id )
+{
+    return emission_table[id & 0xFFF];
+}
+
+// Fill the scratch opacity array from the chunk's block IDs
+void light_load_opacity( ChunkArrays *arrays, LightScratch *scratch )
+{
+    int s, i;
+
+    for( s = 0; s < 16; s++ )
+    {
+        unsigned char *opacity;
+
+        opacity = scratch->opacity + s * 4096;
+        if( arrays->blocks[s] == NULL )
+        {
+            memset(opacity, 0, 4096);
+            continue;
+        }
+
+        if( arrays->add[s] == NULL )
+            for( i = 0; i < 4096; i++ )
+                opacity[i] = opacity_table[arrays->blocks[s][i]];
+        else
+        {
+            unsigned char add[4096];
+
+            unpack_nibbles(arrays->add[s], add, 4096);
+            for( i = 0; i < 4096; i++ )
+                opacity[i] = opacity_table[arrays->blocks[s][i] | add[i] << 8];
+        }
+    }
+}
+
+/*
+Recalculate the heightmap (the lowest Y in each column that receives full
+skylight) for every column whose bit is set in columns, or all columns if
+columns is NULL
+*/
+void light_heightmap( LightScratch *scratch, int *heightmap, unsigned char *columns )
+{
+    int i, y;
+
+    for( i = 0; i < 256; i++ )
+    {
+        if( columns != NULL && (columns[i >> 3] & (1 << (i & 7))) == 0 )
+            continue;
+
+        for( y = 255; y >= 0; y-- )
+            if( scratch->opacity[y * 256 + i] != 0 )
+                break;
+        heightmap[i] = y + 1;
+    }
+}
+
+/*
+Flood light outwards from every cell in the queue, in place on the scratch
+light array.  Cells below low are never written to.
+*/
+static void propagate( LightScratch *scratch, int head, int tail, int low )
+{
+    unsigned char *light, *opacity;
+    int *queue;
+
+    light = scratch->light;
+    opacity = scratch->opacity;
+    queue = scratch->queue;
+
+    while( head != tail )
+    {
+        int cell, level, x, y, z, n, neighbours[6], count;
+
+        cell = queue[head];
+        head = (head + 1) & (LIGHT_QUEUE_SIZE - 1);
+
+        light[cell] &= LIGHT_MASK;
+        level = light[cell];
+        if( level <= 1 )
+            continue;
+
+        x = cell & 15;
+        z = (cell >> 4) & 15;
+        y = cell >> 8;
+
+        count = 0;
+        if( x > 0 )       neighbours[count++] = cell - 1;
+        if( x < 15 )      neighbours[count++] = cell + 1;
+        if( z > 0 )       neighbours[count++] = cell - 16;
+        if( z < 15 )      neighbours[count++] = cell + 16;
+        if( y > low )     neighbours[count++] = cell - 256;
+        if( y < 255 )     neighbours[count++] = cell + 256;
+
+        for( n = 0; n < count; n++ )
+        {
+            int neighbour, next;
+
+            neighbour = neighbours[n];
+            next = level - (opacity[neighbour] > 1 ? opacity[neighbour] : 1);
+            if( next <= (light[neighbour] & LIGHT_MASK) )
+                continue;
+
+            if( light[neighbour] & QUEUED )
+                light[neighbour] = next | QUEUED;
+            else
+            {
+                light[neighbour] = next | QUEUED;
+                queue[tail] = neighbour;
+                tail = (tail + 1) & (LIGHT_QUEUE_SIZE - 1);
+            }
+        }
+    }
+}
+
+static inline int queue_cell( LightScratch *scratch, int tail, int cell )
+{
+    if( scratch->light[cell] & QUEUED )
+        return tail;
+
+    scratch->light[cell] |= QUEUED;
+    scratch->queue[tail] = cell;
+    return (tail + 1) & (LIGHT_QUEUE_SIZE - 1);
+}
+
+/*
+Recompute skylight for every block at or above low, given an up to date
+heightmap and opacity.  Blocks below low keep the light already stored in the
+chunk, and the layer just below low seeds propagation back upwards.  Missing
+sections are treated as air but can't hold light, so nothing is written to
+them.
+*/
+void light_sky( ChunkArrays *arrays, LightScratch *scratch, int *heightmap, int low )
+{
+    unsigned char *light;
+    int i, y, s, tail;
+
+    light = scratch->light;
+    tail = 0;
+
+    // Reset everything at or above low: full light above the heightmap, and
+    // darkness below it until propagation fills it in
+    for( y = low; y < 256; y++ )
+        for( i = 0; i < 256; i++ )
+            light[y * 256 + i] = y >= heightmap[i] ? 15 : 0;
+
+    if( low > 0 )
+    {
+        y = low - 1;
+        s = y >> 4;
+        for( i = 0; i < 256; i++ )
+        {
+            int position, level;
+
+            position = (y & 15) * 256 + i;
+            if( arrays->skylight[s] != NULL )
+                level = (arrays->skylight[s][position >> 1] >> ((position & 1) << 2)) & 0x0F;
+            else
+                level = y >= heightmap[i] ? 15 : 0;
+
+            light[y * 256 + i] = level;
+            if( level > 1 )
+                tail = queue_cell(scratch, tail, y * 256 + i);
+        }
+    }
+
+    // Sky cells only need to spread light where they border a darker cell:
+    // the one directly below the heightmap, and neighbouring columns with a
+    // higher heightmap
+    for( i = 0; i < 256; i++ )
+    {
+        int x, z, top;
+
+        x = i & 15;
+        z = i >> 4;
+        top = heightmap[i];
+        if( x > 0 && heightmap[i - 1] > top )   top = heightmap[i - 1];
+        if( x < 15 && heightmap[i + 1] > top )  top = heightmap[i + 1];
+        if( z > 0 && heightmap[i - 16] > top )  top = heightmap[i - 16];
+        if( z < 15 && heightmap[i + 16] > top ) top = heightmap[i + 16];
+
+        y = heightmap[i] > low ? heightmap[i] : low;
+        if( top > 255 )
+            top = 255;
+        for( ; y <= top; y++ )
+            tail = queue_cell(scratch, tail, y * 256 + i);
+    }
+
+    propagate(scratch, 0, tail, low);
+
+    for( s = low >> 4; s < 16; s++ )
+    {
+        if( arrays->skylight[s] == NULL )
+            continue;
+
+        if( s == low >> 4 && (low & 15) != 0 )
+        {
+            // Only the part of this section at or above low was recomputed
+            int start;
+
+            start = (low & 15) * 256;
+            pack_nibbles(light + s * 4096 + start, arrays->skylight[s] + start / 2, 4096 - start);
+        }
+        else
+            pack_nibbles(light + s * 4096, arrays->skylight[s], 4096);
+    }
+}
+
+/*
+World-level block light.  Unlike skylight, block light is propagated across
+chunk borders, using flood fills over world coordinates.  Chunks are pulled
+in through a ChunkSource as the fills reach them, and kept in a small table
+for the duration of the pass.
+*/
+
+typedef struct {
+    int x, y, z, level;
+} LightNode;
+
+typedef struct {
+    LightNode *nodes;
+    int head, tail, size;
+} LightQueue;
+
+typedef struct {
+    int x, z;
+    bool present, available;
+    ChunkArrays arrays;
+} LightChunk;
+
+typedef struct {
+    ChunkSource *source;
+    LightChunk *chunks;
+    int chunk_count;
+    LightChunk *last;
+} LightWorld;
+
+static const int neighbour_offsets[6][3] = {
+    {-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1}
+};
+
+static void push_node( LightQueue *queue, int x, int y, int z, int level )
+{
+    if( queue->tail == queue->size )
+    {
+        // Reclaim the consumed front of the queue before growing it
+        if( queue->head > 0 )
+        {
+            memmove(queue->nodes, queue->nodes + queue->head, sizeof(LightNode) * (queue->tail - queue->head));
+            queue->tail -= queue->head;
+            queue->head = 0;
+        }
+        if( queue->tail == queue->size )
+        {
+            queue->size = queue->size == 0 ? 4096 : queue->size * 2;
+            queue->nodes = realloc(queue->nodes, sizeof(LightNode) * queue->size);
+        }
+    }
+
+    queue->nodes[queue->tail].x = x;
+    queue->nodes[queue->tail].y = y;
+    queue->nodes[queue->tail].z = z;
+    queue->nodes[queue->tail].level = level;
+    queue->tail++;
+}
+
+// Find (loading if need be) the chunk holding world column (x, z)
+static LightChunk *light_chunk( LightWorld *world, int x, int z )
+{
+    LightChunk *chunk;
+    int cx, cz, slot;
+
+    cx = x >> 4;
+    cz = z >> 4;
+    if( world->last != NULL && world->last->x == cx && world->last->z == cz )
+        return world->last->available ? world->last : NULL;
+
+    slot = (((unsigned int) cx * 73856093u) ^ ((unsigned int) cz * 19349663u)) & (LIGHT_MAX_CHUNKS - 1);
+    while( true )
+    {
+        chunk = world->chunks + slot;
+        if( !chunk->present || (chunk->x == cx && chunk->z == cz) )
+            break;
+        slot = (slot + 1) & (LIGHT_MAX_CHUNKS - 1);
+    }
+
+    if( !chunk->present )
+    {
+        // Past a point, stop spreading into further chunks rather than
+        // filling the table
+        if( world->chunk_count >= LIGHT_MAX_CHUNKS / 2 )
+            return NULL;
+
+        chunk->present = true;
+        chunk->x = cx;
+        chunk->z = cz;
+        chunk->available = world->source->load(world->source->context, cx, cz, &chunk->arrays) == 0;
+        world->chunk_count++;
+    }
+
+    world->last = chunk;
+    return chunk->available ? chunk : NULL;
+}
+
+static int get_block_light( LightWorld *world, int x, int y, int z )
+{
+    LightChunk *chunk;
+    int position;
+
+    chunk = light_chunk(world, x, z);
+    if( chunk == NULL || chunk->arrays.blocklight[y >> 4] == NULL )
+        return 0;
+
+    position = (y & 15) * 256 + (z & 15) * 16 + (x & 15);
+    return (chunk->arrays.blocklight[y >> 4][position >> 1] >> ((position & 1) << 2)) & 0x0F;
+}
+
+static void set_block_light( LightWorld *world, int x, int y, int z, int level )
+{
+    LightChunk *chunk;
+    unsigned char *array;
+    int position, shift;
+
+    chunk = light_chunk(world, x, z);
+    if( chunk == NULL )
+        return;
+
+    if( chunk->arrays.blocklight[y >> 4] == NULL )
+    {
+        if( level == 0 )
+            return;
+        if( world->source->add_section(world->source->context, chunk->x, chunk->z, y >> 4, &chunk->arrays) != 0 )
+            return;
+    }
+
+    array = chunk->arrays.blocklight[y >> 4];
+    position = (y & 15) * 256 + (z & 15) * 16 + (x & 15);
+    shift = (position & 1) << 2;
+    array[position >> 1] = (array[position >> 1] & (0xF0 >> shift)) | level << shift;
+}
+
+// Block ID at a world position; unloadable chunks read as solid
+static int get_block_id( LightWorld *world, int x, int y, int z )
+{
+    LightChunk *chunk;
+    int position, id, s;
+
+    chunk = light_chunk(world, x, z);
+    if( chunk == NULL )
+        return 1;
+
+    s = y >> 4;
+    if( chunk->arrays.blocks[s] == NULL )
+        return 0;
+
+    position = (y & 15) * 256 + (z & 15) * 16 + (x & 15);
+    id = chunk->arrays.blocks[s][position];
+    if( chunk->arrays.add[s] != NULL )
+        id |= ((chunk->arrays.add[s][position >> 1] >> ((position & 1) << 2)) & 0x0F) << 8;
+
+    return id;
+}
+
+/*
+Update block light around count changed positions (x, y, z triplets in world
+coordinates), all in one pass: light that came from the old blocks is removed
+with a flood fill first, then light from the new blocks, plus any light the
+removal uncovered, is spread with a second one.
+*/
+void light_blocks( ChunkSource *source, int *positions, int count )
+{
+    LightWorld world;
+    LightQueue removal, addition;
+    int i, n;
+
+    memset(&world, 0, sizeof(LightWorld));
+    memset(&removal, 0, sizeof(LightQueue));
+    memset(&addition, 0, sizeof(LightQueue));
+    world.source = source;
+    world.chunks = calloc(LIGHT_MAX_CHUNKS, sizeof(LightChunk));
+
+    for( i = 0; i < count; i++ )
+    {
+        int x, y, z, level, emission;
+
+        x = positions[i * 3];
+        y = positions[i * 3 + 1];
+        z = positions[i * 3 + 2];
+        if( y < 0 || y > 255 || light_chunk(&world, x, z) == NULL )
+            continue;
+
+        // Writing the block usually overwrote its old light too, so assume it
+        // could have been as bright as its brightest neighbour allows
+        level = get_block_light(&world, x, y, z);
+        for( n = 0; n < 6; n++ )
+        {
+            int ny, neighbour;
+
+            ny = y + neighbour_offsets[n][1];
+            if( ny < 0 || ny > 255 )
+                continue;
+
+            neighbour = get_block_light(&world, x + neighbour_offsets[n][0], ny, z + neighbour_offsets[n][2]) + 1;
+            if( neighbour > level )
+                level = neighbour > 15 ? 15 : neighbour;
+        }
+
+        if( level > 0 )
+        {
+            set_block_light(&world, x, y, z, 0);
+            push_node(&removal, x, y, z, level);
+        }
+
+        // The block may also have opened up a path for its neighbours' light
+        for( n = 0; n < 6; n++ )
+            push_node(&addition, x + neighbour_offsets[n][0], y + neighbour_offsets[n][1], z + neighbour_offsets[n][2], 0);
+
+        emission = block_emission(get_block_id(&world, x, y, z));
+        if( emission > 0 )
+            push_node(&addition, x, y, z, emission);
+    }
+
+    // Removal: darken everything that could have been lit by a removed
+    // value, queueing anything brighter at the edge to fill back in
+    while( removal.head != removal.tail )
+    {
+        LightNode node;
+
+        node = removal.nodes[removal.head++];
+        for( n = 0; n < 6; n++ )
+        {
+            int x, y, z, level;
+
+            x = node.x + neighbour_offsets[n][0];
+            y = node.y + neighbour_offsets[n][1];
+            z = node.z + neighbour_offsets[n][2];
+            if( y < 0 || y > 255 )
+                continue;
+
+            level = get_block_light(&world, x, y, z);
+            if( level != 0 && level < node.level )
+            {
+                int emission;
+
+                set_block_light(&world, x, y, z, 0);
+                push_node(&removal, x, y, z, level);
+
+                emission = block_emission(get_block_id(&world, x, y, z));
+                if( emission > 0 )
+                    push_node(&addition, x, y, z, emission);
+            }
+            else if( level >= node.level )
+                push_node(&addition, x, y, z, 0);
+        }
+    }
+
+    // Addition: nodes with a level are light sources to (re)apply, nodes
+    // without one spread whatever light is already stored there
+    while( addition.head != addition.tail )
+    {
+        LightNode node;
+        int level;
+
+        node = addition.nodes[addition.head++];
+        if( node.y < 0 || node.y > 255 )
+            continue;
+
+        level = get_block_light(&world, node.x, node.y, node.z);
+        if( node.level > level )
+        {
+            level = node.level;
+            set_block_light(&world, node.x, node.y, node.z, level);
+        }
+        if( level <= 1 )
+            continue;
+
+        for( n = 0; n < 6; n++ )
+        {
+            int x, y, z, opacity, next;
+
+            x = node.x + neighbour_offsets[n][0];
+            y = node.y + neighbour_offsets[n][1];
+            z = node.z + neighbour_offsets[n][2];
+            if( y < 0 || y > 255 )
+                continue;
+
+            opacity = block_opacity(get_block_id(&world, x, y, z));
+            next = level - (opacity > 1 ? opacity : 1);
+            if( next > get_block_light(&world, x, y, z) )
+            {
+                set_block_light(&world, x, y, z, next);
+                push_node(&addition, x, y, z, 0);
+            }
+        }
+    }
+
+    free(removal.nodes);
+    free(addition.nodes);
+    free(world.chunks);
+}
+
+/*
+Region relighting.  Every chunk of a region is first lit on its own (its
+heightmap, skylight, and light from its own sources), as independent tiles.
+Light is then exchanged across chunk borders in rounds: each round takes a
+snapshot of every chunk's edges, and each chunk with a neighbour that changed
+pulls in whatever light its neighbours' edges would give it.  Since chunks
+only ever read the snapshot during a round, the result doesn't depend on how
+the chunks are split between threads.
+*/
+
+// Light on each side of a chunk, indexed y * 16 + t, where t runs along the
+// side.  Sides are x = 0, x = 15, z = 0 and z = 15 in that order
+typedef struct {
+    unsigned char sky[4][4096], block[4][4096];
+} LightEdges;
+
+typedef struct {
+    ChunkArrays **chunks;
+    int (*heightmaps)[256];
+    LightEdges *edges;
+    unsigned char *active, *changed;
+    int pass, next;
+} RegionLightJob;
+
+enum { PASS_LOCAL, PASS_EDGES, PASS_EXCHANGE };
+
+// Stored light at a column-relative position.  Missing sections lie above
+// the terrain, so they're open to the sky but hold no block light
+static inline int stored_light( unsigned char **nibbles, int *heightmap, int x, int y, int z )
+{
+    int position;
+
+    if( nibbles[y >> 4] == NULL )
+        return heightmap != NULL && y >= heightmap[z * 16 + x] ? 15 : 0;
+
+    position = (y & 15) * 256 + z * 16 + x;
+    return (nibbles[y >> 4][position >> 1] >> ((position & 1) << 2)) & 0x0F;
+}
+
+static void unpack_light( unsigned char **nibbles, int *heightmap, unsigned char *light )
+{
+    int s, i;
+
+    for( s = 0; s < 16; s++ )
+    {
+        unsigned char *dst;
+
+        dst = light + s * 4096;
+        if( nibbles[s] == NULL )
+        {
+            for( i = 0; i < 4096; i++ )
+                dst[i] = heightmap != NULL && s * 16 + (i >> 8) >= heightmap[i & 255] ? 15 : 0;
+            continue;
+        }
+
+        unpack_nibbles(nibbles[s], dst, 4096);
+    }
+}
+
+static int cell_opacity( ChunkArrays *arrays, int cell )
+{
+    int s, position, id;
+
+    s = cell >> 12;
+    if( arrays->blocks[s] == NULL )
+        return 0;
+
+    position = cell & 4095;
+    id = arrays->blocks[s][position];
+    if( arrays->add[s] != NULL )
+        id |= ((arrays->add[s][position >> 1] >> ((position & 1) << 2)) & 0x0F) << 8;
+
+    return opacity_table[id];
+}
+
+// Light a chunk as if it stood alone
+static void light_tile( ChunkArrays *arrays, LightScratch *scratch, int *heightmap )
+{
+    unsigned char *light;
+    int s, i, tail;
+
+    light_load_opacity(arrays, scratch);
+    light_heightmap(scratch, heightmap, NULL);
+    light_sky(arrays, scratch, heightmap, 0);
+
+    light = scratch->light;
+    memset(light, 0, 65536);
+    tail = 0;
+    for( s = 0; s < 16; s++ )
+    {
+        unsigned char add[4096];
+
+        if( arrays->blocks[s] == NULL )
+            continue;
+
+        if( arrays->add[s] != NULL )
+            unpack_nibbles(arrays->add[s], add, 4096);
+        else
+            memset(add, 0, 4096);
+
+        for( i = 0; i < 4096; i++ )
+        {
+            int emission;
+
+            emission = emission_table[arrays->blocks[s][i] | add[i] << 8];
+            if( emission > 0 )
+            {
+                light[s * 4096 + i] = emission;
+                tail = queue_cell(scratch, tail, s * 4096 + i);
+            }
+        }
+    }
+
+    propagate(scratch, 0, tail, 0);
+
+    for( s = 0; s < 16; s++ )
+        if( arrays->blocklight[s] != NULL )
+            pack_nibbles(light + s * 4096, arrays->blocklight[s], 4096);
+}
+
+static void save_edges( unsigned char **nibbles, int *heightmap, unsigned char edges[4][4096] )
+{
+    int y, t;
+
+    for( y = 0; y < 256; y++ )
+        for( t = 0; t < 16; t++ )
+        {
+            edges[0][y * 16 + t] = stored_light(nibbles, heightmap, 0, y, t);
+            edges[1][y * 16 + t] = stored_light(nibbles, heightmap, 15, y, t);
+            edges[2][y * 16 + t] = stored_light(nibbles, heightmap, t, y, 0);
+            edges[3][y * 16 + t] = stored_light(nibbles, heightmap, t, y, 15);
+        }
+}
+
+/*
+Pull light in from the neighbouring edges (any of which may be NULL) and
+spread it through the chunk.  The scratch opacity is only filled in once
+there's something to spread, as most chunks in later rounds have nothing.
+Returns true if any stored light changed.
+*/
+static bool import_edges( ChunkArrays *arrays, unsigned char **nibbles, int *heightmap, LightScratch *scratch,
+                          bool *opacity_ready, unsigned char *incoming[4] )
+{
+    int side, y, t, tail, s;
+    bool unpacked;
+
+    unpacked = false;
+    tail = 0;
+    for( side = 0; side < 4; side++ )
+    {
+        if( incoming[side] == NULL )
+            continue;
+
+        for( y = 0; y < 256; y++ )
+            for( t = 0; t < 16; t++ )
+            {
+                int x, z, cell, level, opacity, next;
+
+                level = incoming[side][y * 16 + t];
+                if( level <= 1 )
+                    continue;
+
+                x = side == 0 ? 0 : side == 1 ? 15 : t;
+                z = side == 2 ? 0 : side == 3 ? 15 : t;
+                cell = y * 256 + z * 16 + x;
+
+                opacity = *opacity_ready ? scratch->opacity[cell] : cell_opacity(arrays, cell);
+                next = level - (opacity > 1 ? opacity : 1);
+                if( next <= 0 )
+                    continue;
+
+                if( !unpacked )
+                {
+                    if( next <= stored_light(nibbles, heightmap, x, y, z) )
+                        continue;
+
+                    if( !*opacity_ready )
+                    {
+                        light_load_opacity(arrays, scratch);
+                        *opacity_ready = true;
+                    }
+                    unpack_light(nibbles, heightmap, scratch->light);
+                    unpacked = true;
+                }
+
+                if( next > (scratch->light[cell] & LIGHT_MASK) )
+                {
+                    scratch->light[cell] = next | (scratch->light[cell] & QUEUED);
+                    tail = queue_cell(scratch, tail, cell);
+                }
+            }
+    }
+
+    if( !unpacked )
+        return false;
+
+    propagate(scratch, 0, tail, 0);
+
+    for( s = 0; s < 16; s++ )
+        if( nibbles[s] != NULL )
+            pack_nibbles(scratch->light + s * 4096, nibbles[s], 4096);
+
+    return true;
+}
+
+static void exchange_tile( RegionLightJob *job, LightScratch *scratch, int index )
+{
+    unsigned char *sky[4], *block[4];
+    int x, z, side;
+    bool opacity_ready, changed;
+
+    x = index & 31;
+    z = index >> 5;
+    for( side = 0; side < 4; side++ )
+    {
+        int neighbour;
+
+        // Each side faces the opposite side of the neighbouring chunk
+        neighbour = side == 0 ? (x > 0 ? index - 1 : -1) :
+                    side == 1 ? (x < 31 ? index + 1 : -1) :
+                    side == 2 ? (z > 0 ? index - 32 : -1) :
+                                (z < 31 ? index + 32 : -1);
+        if( neighbour < 0 || job->chunks[neighbour] == NULL )
+            sky[side] = block[side] = NULL;
+        else
+        {
+            sky[side] = job->edges[neighbour].sky[side ^ 1];
+            block[side] = job->edges[neighbour].block[side ^ 1];
+        }
+    }
+
+    opacity_ready = false;
+    changed = import_edges(job->chunks[index], job->chunks[index]->skylight, job->heightmaps[index],
+                           scratch, &opacity_ready, sky);
+    changed |= import_edges(job->chunks[index], job->chunks[index]->blocklight, NULL,
+                            scratch, &opacity_ready, block);
+    job->changed[index] = changed;
+}
+
+static void *region_light_worker( void *arg )
+{
+    RegionLightJob *job;
+    LightScratch *scratch;
+
+    job = (RegionLightJob *) arg;
+    scratch = malloc(sizeof(LightScratch));
+
+    while( true )
+    {
+        int index;
+
+        index = __sync_fetch_and_add(&job->next, 1);
+        if( index >= 1024 )
+            break;
+        if( job->chunks[index] == NULL )
+            continue;
+
+        if( job->pass == PASS_LOCAL )
+            light_tile(job->chunks[index], scratch, job->heightmaps[index]);
+        else if( job->pass == PASS_EDGES )
+        {
+            // Edges only move when the chunk changed last round
+            if( !job->changed[index] )
+                continue;
+
+            save_edges(job->chunks[index]->skylight, job->heightmaps[index], job->edges[index].sky);
+            save_edges(job->chunks[index]->blocklight, NULL, job->edges[index].block);
+        }
+        else if( job->active[index] )
+            exchange_tile(job, scratch, index);
+    }
+
+    free(scratch);
+    return NULL;
+}
+
+static void run_region_pass( RegionLightJob *job, int pass, int threads )
+{
+    pthread_t *workers;
+    int i;
+
+    job->pass = pass;
+    job->next = 0;
+    if( threads <= 1 )
+    {
+        region_light_worker(job);
+        return;
+    }
+
+    workers = malloc(sizeof(pthread_t) * threads);
+    for( i = 0; i < threads; i++ )
+        pthread_create(&workers[i], NULL, region_light_worker, job);
+    for( i = 0; i < threads; i++ )
+        pthread_join(workers[i], NULL);
+    free(workers);
+}
+
+/*
+Relight a whole region.  chunks holds 1024 entries indexed z * 32 + x, NULL
+where the region has no chunk, and heightmaps receives each chunk's new
+heightmap.  Light doesn't cross into neighbouring regions.  Touches no
+Python objects, so can run without the GIL.  Returns the number of border
+exchange rounds it took.
+*/
+int light_region( ChunkArrays **chunks, int (*heightmaps)[256], int threads )
+{
+    RegionLightJob job;
+    int i, rounds;
+    bool changed;
+
+    init_light_tables();
+
+    memset(&job, 0, sizeof(RegionLightJob));
+    job.chunks = chunks;
+    job.heightmaps = heightmaps;
+    job.edges = malloc(sizeof(LightEdges) * 1024);
+    job.active = malloc(1024);
+    job.changed = malloc(1024);
+
+    run_region_pass(&job, PASS_LOCAL, threads);
+
+    memset(job.active, 1, 1024);
+    memset(job.changed, 1, 1024);
+    rounds = 0;
+    do
+    {
+        run_region_pass(&job, PASS_EDGES, threads);
+        memset(job.changed, 0, 1024);
+        run_region_pass(&job, PASS_EXCHANGE, threads);
+        rounds++;
+
+        // Only chunks next to one that changed can gain anything next round
+        changed = false;
+        memset(job.active, 0, 1024);
+        for( i = 0; i < 1024; i++ )
+        {
+            if( !job.changed[i] )
+                continue;
+
+            changed = true;
+            if( (i & 31) > 0 )  job.active[i - 1] = 1;
+            if( (i & 31) < 31 ) job.active[i + 1] = 1;
+            if( i >= 32 )       job.active[i - 32] = 1;
+            if( i < 992 )       job.active[i + 32] = 1;
+        }
+    } while( changed );
+
+    free(job.changed);
+    free(job.active);
+    free(job.edges);
+
+    return rounds;
+}
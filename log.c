@@ -0,0 +1,25 @@
+/*
+log.c
+
+Output side of the logging in log.h, and the level it's filtered by
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include "log.h"
+
+int log_level = LOG_WARNING;
+
+static const char *level_names[] = {"", "error", "warning", "info", "debug"};
+
+// Writes one message, as "minecraft <level>: <message>" on its own line
+void log_message( int level, const char *format, ... )
+{
+    va_list args;
+
+    fprintf(stderr, "minecraft %s: ", level_names[level]);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
@@ -0,0 +1,39 @@
+/*
+log.h
+
+Leveled logging.  Messages go to stderr when their level is at or below the
+level set at runtime with minecraft.set_log_level (LOG_WARNING by default).
+Anything above LOG_COMPILE_LEVEL is compiled out entirely, arguments and all,
+so release builds can drop debug logging from hot paths with
+-DLOG_COMPILE_LEVEL=LOG_WARNING (or LOG_NONE for no logging at all).
+*/
+
+#ifndef LOG_INFO_H
+#define LOG_INFO_H
+
+#define LOG_NONE        0
+#define LOG_ERROR       1
+#define LOG_WARNING     2
+#define LOG_INFO        3
+#define LOG_DEBUG       4
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL   LOG_DEBUG
+#endif
+
+extern int log_level;
+
+void log_message( int level, const char *format, ... ) __attribute__((format(printf, 2, 3)));
+
+// Whether a level would be logged, for guarding extra work done only to log
+#define LOG_ENABLED(level) ((level) <= LOG_COMPILE_LEVEL && (level) <= log_level)
+
+#define LOG(level, ...) \
+    do { if( LOG_ENABLED(level) ) log_message(level, __VA_ARGS__); } while( 0 )
+
+#define log_error(...)      LOG(LOG_ERROR, __VA_ARGS__)
+#define log_warning(...)    LOG(LOG_WARNING, __VA_ARGS__)
+#define log_info(...)       LOG(LOG_INFO, __VA_ARGS__)
+#define log_debug(...)      LOG(LOG_DEBUG, __VA_ARGS__)
+
+#endif
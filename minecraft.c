@@ -6,47 +6,35 @@ Core module definition plus functionality that doesn't really fit anywhere else
 
 #include <Python.h>
 #include <structmember.h>
-#include <regex.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include "minecraft.h"
+#include "log.h"
 
-// Get information from the filename
-void region_information( int *coords, char *filename )
+// Sets which messages are logged, from LOG_NONE up to LOG_DEBUG
+static PyObject *minecraft_set_log_level( PyObject *self, PyObject *args )
 {
-    regmatch_t matches[3];
-    regex_t regex;
-    int reti;
+    int level;
 
-    coords[0] = -1;
-    coords[1] = -1;
+    if( !PyArg_ParseTuple(args, "i", &level) )
+        return NULL;
 
-    reti = regcomp(&regex, "^.*\\.([^.]*)\\.([^.]*)\\.mca$", REG_EXTENDED);
-    if ( reti )
+    if( level < LOG_NONE || level > LOG_DEBUG )
     {
-        printf("Could not compile expression");
-        return;
+        PyErr_Format(PyExc_Exception, "Log level must be between LOG_NONE (%d) and LOG_DEBUG (%d)", LOG_NONE, LOG_DEBUG);
+        return NULL;
     }
+    log_level = level;
 
-    reti = regexec(&regex, filename, 3, matches, 0);
-    if ( !reti )
-    {
-        char coord[20];
-
-        strncpy ( coord, filename + matches[1].rm_so, matches[1].rm_eo - matches[1].rm_eo + 1 );
-        coords[0] = atoi(coord);
-
-        strncpy ( coord, filename + matches[2].rm_so, matches[2].rm_eo - matches[2].rm_eo + 1 );
-        coords[1]= atoi(coord);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
 
-        printf("\nx: %d | z: %d\n", coords[0], coords[1]);
-    } 
-    else
-    {
-        printf("NO MATCH!");
-    }
+static PyObject *minecraft_get_log_level( PyObject *self )
+{
+    return PyInt_FromLong(log_level);
 }
 
 /*
@@ -56,6 +44,11 @@ Python module set-up
 */
 static PyMethodDef MinecraftMethods[] = {
 //    {"get_chunk", get_chunk, METH_VARARGS, "Get a specified chunk."},
+    {"set_log_level", (PyCFunction) minecraft_set_log_level, METH_VARARGS, "Set the level of messages logged to stderr (LOG_NONE, LOG_ERROR, LOG_WARNING, LOG_INFO or LOG_DEBUG)."},
+    {"get_log_level", (PyCFunction) minecraft_get_log_level, METH_NOARGS, "Get the level of messages logged to stderr."},
+    {"start_trace", (PyCFunction) minecraft_start_trace, METH_VARARGS, "Start writing chunk and region load/save spans to a Chrome trace (JSON) file."},
+    {"stop_trace", (PyCFunction) minecraft_stop_trace, METH_NOARGS, "Finish and close the Chrome trace file."},
+    {"set_trace_callback", (PyCFunction) minecraft_set_trace_callback, METH_VARARGS, "Call a function with (operation, x, z, start_ns, duration_ns) as each chunk or region load/save ends, or None to stop."},
     {NULL, NULL, 0, NULL} /* Sentinel */
 };
 
@@ -64,6 +57,16 @@ PyMODINIT_FUNC initminecraft(void)
     PyObject *m;
     
     m = Py_InitModule3("minecraft", MinecraftMethods, "Minecraft module");
+    init_tag_keys();
+
+    // Log levels, for set_log_level; LOG_COMPILE_LEVEL is the highest one
+    // this build can log at all
+    PyModule_AddIntConstant(m, "LOG_NONE", LOG_NONE);
+    PyModule_AddIntConstant(m, "LOG_ERROR", LOG_ERROR);
+    PyModule_AddIntConstant(m, "LOG_WARNING", LOG_WARNING);
+    PyModule_AddIntConstant(m, "LOG_INFO", LOG_INFO);
+    PyModule_AddIntConstant(m, "LOG_DEBUG", LOG_DEBUG);
+    PyModule_AddIntConstant(m, "LOG_COMPILE_LEVEL", LOG_COMPILE_LEVEL);
 
     // Block
     minecraft_BlockType.tp_new = PyType_GenericNew;
@@ -86,7 +89,13 @@ PyMODINIT_FUNC initminecraft(void)
     Py_INCREF(&minecraft_WorldType);
     PyModule_AddObject(m, "World", (PyObject *) &minecraft_WorldType);
 
-    // Block
+    // World iterator (only created by World, so no tp_new)
+    if( PyType_Ready(&minecraft_WorldIteratorType) < 0 )
+        return;
+    Py_INCREF(&minecraft_WorldIteratorType);
+    PyModule_AddObject(m, "WorldIterator", (PyObject *) &minecraft_WorldIteratorType);
+
+    // Generator
     minecraft_GeneratorType.tp_new = PyType_GenericNew;
     if( PyType_Ready(&minecraft_GeneratorType) < 0 )
         return;
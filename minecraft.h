@@ -7,6 +7,8 @@ Extension module header file
 #ifndef PARAMETERS
 #define PARAMETERS
 
+#include <pthread.h>
+
 // Buffer sizes
 #define SMALL_DEFLATE_MAX   10000;
 #define SMALL_INFLATE_MAX   20000;
@@ -17,6 +19,33 @@ Extension module header file
 #define MAX_REGIONS             8
 #define NEW_REGION_BUFFER_SIZE  2000000
 #define REGION_BUFFER_PADDING   10000
+#define BLOCK_CACHE_SIZE        8192
+#define PREFETCH_SLOTS          4
+#define CHUNK_CACHE_BUCKETS     1024
+#define CHUNK_CACHE_BUDGET      (32 * 1024 * 1024)
+#define ARENA_BLOCK_SIZE        (1 << 20)
+#define ARENA_ALIGNMENT         16
+#define TAG_KEY_SLOTS           256     // Power of two
+#define CHUNK_BUFFER_SIZE       1000000 // Scratch for one chunk's NBT, matching CHUNK_INFLATE_MAX and CHUNK_DEFLATE_MAX
+#define PALETTE_MAX             256     // Distinct blocks a compact section can hold
+#define PALETTE_HASH_BITS       9
+#define PALETTE_HASH_SLOTS      (1 << PALETTE_HASH_BITS)
+#define REGION_CHUNKS           1024
+#define SUMMARY_MAGIC           "MCI1"  // Start of a region's .mci block ID summary file
+
+// A block's four fields packed into one int, as returned by get_block_raw
+#define PACK_BLOCK(id, data, blocklight, skylight) \
+    ((id) | (data) << 12 | (blocklight) << 16 | (skylight) << 20)
+
+// Generation
+#define PERMUTATIONS            256
+#define MAX_OCTAVES             16
+#define OCTAVE_SEED_STEP        7919
+#define GENERATED_NBT_MAX       200000
+
+// Lighting
+#define LIGHT_QUEUE_SIZE        65536
+#define LIGHT_MAX_CHUNKS        4096
 
 #endif
 
@@ -28,6 +57,28 @@ typedef struct TagType{
     unsigned char sub_tag_id; // Optional, for List tag
 } TagType;
 
+// Parameters for fractal (octave) noise
+typedef struct {
+    int octaves;
+    float frequency, amplitude, lacunarity, persistence;
+} Fractal;
+
+// Tunables for native terrain generation
+typedef struct {
+    Fractal height;
+    int base_height, sea_level, dirt_depth;
+    unsigned char biome;
+    float cave_frequency, cave_threshold;
+} TerrainParams;
+
+// A chunk column generated in C, before it becomes NBT
+typedef struct {
+    unsigned char blocks[16][4096], data[16][2048], blocklight[16][2048], skylight[16][2048];
+    unsigned char biomes[256];
+    int heightmap[256];
+    int sections; // Number of sections, from the bottom, that hold blocks
+} GeneratedChunk;
+
 typedef struct {
     PyObject_HEAD
     unsigned short id;
@@ -38,52 +89,253 @@ typedef struct {
     PyObject_HEAD
     PyObject *world, *dict;
     int x, z;
+
+    // Columns (z * 16 + x) touched since lighting was last calculated, and
+    // the lowest Y touched in them
+    bool dirty;
+    int dirty_min_y;
+    unsigned char dirty_columns[32];
+
+    bool modified; // Changed since it was last written to its region
 } Chunk;
 
+// Pointers into a chunk's section storage, indexed by section Y, with NULL
+// for any section (or array within it) the chunk doesn't have
 typedef struct {
+    unsigned char *blocks[16], *add[16], *data[16], *blocklight[16], *skylight[16];
+} ChunkArrays;
+
+// Where world-level lighting gets chunks from: load fills in a chunk's
+// arrays, and add_section creates a missing section and refreshes them.
+// Both return 0 on success
+typedef struct {
+    void *context;
+    int (*load)( void *context, int cx, int cz, ChunkArrays *arrays );
+    int (*add_section)( void *context, int cx, int cz, int y, ChunkArrays *arrays );
+} ChunkSource;
+
+// Working space for lighting a chunk column, one byte per block
+typedef struct {
+    unsigned char light[65536], opacity[65536];
+    int queue[LIGHT_QUEUE_SIZE];
+} LightScratch;
+
+// The block IDs in each section of a chunk (see summary.c): bit id & 255 of
+// ids[y] is set if section y holds a block with such an ID
+typedef struct {
+    bool summarized;         // Otherwise nothing is known about the chunk
+    unsigned short sections; // Bit y set if section y exists
+    unsigned char ids[16][32];
+} ChunkSummary;
+
+typedef struct Region {
     unsigned char *buffer;
     int x, z, buffer_size, current_size;
+    ChunkSummary *summaries; // One per chunk, or NULL if not being kept
+    bool modified; // Chunks have been written to it since it was loaded
     struct Region *next; // Meant to function as a linked list, as part of the World
 } Region;
 
+// A region file being read in the background
+typedef struct {
+    int x, z, state, size;
+    unsigned int sequence; // Order requested in, oldest first
+    unsigned char *buffer;
+} PrefetchSlot;
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    PrefetchSlot slots[PREFETCH_SLOTS];
+    unsigned int sequence;
+    char *path;
+    bool stop;
+} Prefetcher;
+
+// A decompressed chunk, keyed by its region and index within the region
+typedef struct CacheEntry {
+    int region_x, region_z, index, size;
+    unsigned char *buffer;
+    struct CacheEntry *hash_next;     // Next entry in the same bucket
+    struct CacheEntry *newer, *older; // Neighbours by last use
+} CacheEntry;
+
+typedef struct {
+    CacheEntry *buckets[CHUNK_CACHE_BUCKETS];
+    CacheEntry *newest, *oldest;
+    int bytes, budget;
+} ChunkCache;
+
 typedef struct {
     PyObject_HEAD
     PyObject *level; // level.dat dictionary
     char *path;      // path to the world
     Region *regions;
+    Region *saving;  // Regions evicted from the list, while they're written out
 
     // Chunk holding code, probably will be moved
     PyObject **chunks;
+
+    // Decompressed chunks, so reloading a chunk skips inflating it
+    ChunkCache cache;
+
+    // Background region reading, started on first use
+    Prefetcher *prefetcher;
+    bool read_ahead, has_last_region;
+    int last_region_x, last_region_z;
+
+    bool compact_chunks; // Compact chunks as they're loaded into the table
+    bool summarize_regions; // Keep block ID summaries of regions, for find_block
 } World;
 
+// Walks the regions (or the populated chunks) of a World
+typedef struct {
+    PyObject_HEAD
+    World *world;
+    bool chunks, bounded;
+    int bbox[4]; // x1, z1, x2, z2 in chunk coordinates
+    int *regions; // (x, z) pairs
+    int region_count, region_index, chunk_index;
+    unsigned char locations[4096]; // The current region's location table
+} WorldIterator;
+
+// arena.c
+void *arena_alloc( size_t size );
+void *arena_calloc( size_t size );
+size_t arena_mark( void );
+void arena_release( size_t mark );
+
 // block.c
-PyTypeObject minecraft_BlockType;
+extern PyTypeObject minecraft_BlockType;
 int Block_init( Block *self, PyObject *args, PyObject *kwds );
+PyObject *get_block_object( int packed );
+
+// cache.c
+unsigned char *cache_lookup( ChunkCache *cache, int x, int z );
+void cache_insert( ChunkCache *cache, int x, int z, unsigned char *buffer, int size );
+void cache_invalidate( ChunkCache *cache, int x, int z );
+void clear_cache( ChunkCache *cache );
 
 // chunk.c
-PyTypeObject minecraft_ChunkType;
+extern PyTypeObject minecraft_ChunkType;
 int Chunk_init( Chunk *self, PyObject *args, PyObject *kwds );
 PyObject *Chunk_get_block( Chunk *self, PyObject *args );
 PyObject *Chunk_put_block( Chunk *self, PyObject *args );
+PyObject *find_section( Chunk *chunk, int y );
+PyObject *get_section( Chunk *chunk, int y, bool create );
+int get_block_raw( Chunk *chunk, int x, int y, int z );
+char get_nibble( char *byte_array, int index );
+void set_nibble( char *byte_array, int index, unsigned char value );
+void mark_dirty( Chunk *chunk, int x1, int z1, int x2, int z2, int y );
+int read_chunk_arrays( Chunk *chunk, ChunkArrays *arrays, PyObject **compact );
+int get_chunk_arrays( Chunk *chunk, ChunkArrays *arrays );
+PyObject *create_section( Chunk *chunk, int y );
+
+// edit.c
+PyObject *World_fill( World *self, PyObject *args );
+PyObject *World_replace( World *self, PyObject *args );
+PyObject *World_copy( World *self, PyObject *args );
+PyObject *World_get_blocks( World *self, PyObject *args );
+PyObject *World_put_blocks( World *self, PyObject *args );
 
 // generator.c
-PyTypeObject minecraft_GeneratorType;
+extern PyTypeObject minecraft_GeneratorType;
+
+// nibble.c
+void unpack_nibbles( const unsigned char *src, unsigned char *dst, int count );
+void pack_nibbles( const unsigned char *src, unsigned char *dst, int count );
+void set_bytes_masked( unsigned char *dst, const unsigned char *mask, unsigned char value, int count );
+void set_nibbles_masked( unsigned char *array, const unsigned char *mask, unsigned char value, int count );
+int match_ids( const unsigned char *blocks, const unsigned char *add, int id, unsigned char *mask, int count );
+
+// noise.c
+void build_permutations( int *perm, int seed );
+float noise3( int *perm, float x, float y, float z );
+void noise3_row( int *perm, float *out, int count, float x, float y, float z, float step, float amplitude );
+void noise3_grid( int *perm, float *out, float x, float y, float z, int width, int height, int depth, float scale );
+void noise3_points( int *perm, float *out, const float *coords, int count );
+float noise2( int *perm, float x, float y );
+void noise2_row( int *perm, float *out, int count, float x, float y, float step, float amplitude );
+void noise2_grid( int *perm, float *out, float x, float z, int width, int depth, float scale );
+void fbm3_grid( int *perms, Fractal *fractal, float *out, float x, float y, float z, int width, int height, int depth );
+void fbm2_grid( int *perms, Fractal *fractal, float *out, float x, float z, int width, int depth );
+
+// terrain.c
+void default_terrain_params( TerrainParams *params );
+void generate_column( int *perms, TerrainParams *params, int cx, int cz, GeneratedChunk *out );
+PyObject *generated_chunk_to_dict( GeneratedChunk *chunk, int cx, int cz );
+int generated_chunk_to_nbt( GeneratedChunk *chunk, int cx, int cz, unsigned char *dst );
+int generate_area( int *perms, TerrainParams *params, char *path, int rx1, int rz1, int rx2, int rz2, int threads );
+
+// iterator.c
+extern PyTypeObject minecraft_WorldIteratorType;
+PyObject *create_world_iterator( World *world, bool chunks, int *bbox );
+
+// light.c
+void init_light_tables( void );
+unsigned char block_opacity( int id );
+unsigned char block_emission( int id );
+void light_load_opacity( ChunkArrays *arrays, LightScratch *scratch );
+void light_heightmap( LightScratch *scratch, int *heightmap, unsigned char *columns );
+void light_sky( ChunkArrays *arrays, LightScratch *scratch, int *heightmap, int low );
+void light_blocks( ChunkSource *source, int *positions, int count );
+int light_region( ChunkArrays **chunks, int (*heightmaps)[256], int threads );
 
 // nbt.c
 long swap_endianness( unsigned char *buffer, int bytes );
 void swap_endianness_in_memory( unsigned char *buffer, int bytes );
 void dump_buffer( unsigned char *buffer, int count );
-int inf( unsigned char *dst, unsigned char *src, int bytes, int mode );
+int inf( unsigned char *dst, unsigned char *src, int bytes, int mode, int *size );
 int def( unsigned char *dst, unsigned char *src, int bytes, int mode, int *size );
 PyObject *get_tag( unsigned char *tag, char tag_id, int *moved );
 int write_tags( unsigned char *dst, PyObject *dict, TagType tags[] );
+void init_tag_keys( void );
+extern PyObject *key_level, *key_sections, *key_y, *key_blocks, *key_add, *key_data;
+extern PyObject *key_block_light, *key_sky_light, *key_height_map, *key_biomes;
+extern PyObject *key_x_pos, *key_z_pos, *key_last_update, *key_terrain_populated;
+extern PyObject *key_entities, *key_tile_entities, *key_palette, *key_indices;
+
+// palette.c
+bool is_compact( PyObject *section );
+bool is_uniform( PyObject *section );
+bool palette_holds( PyObject *section, int id );
+void make_uniform( PyObject *section, unsigned int packed );
+int compact_block_raw( PyObject *section, int position );
+int compact_section( PyObject *section );
+void expand_section( PyObject *section );
+int compact_chunk( Chunk *chunk );
+PyObject *expanded_chunk_dict( PyObject *dict );
+
+// prefetch.c
+bool prefetch_region( World *world, int x, int z );
+bool take_prefetched( World *world, int x, int z, unsigned char **buffer, int *size );
+void read_ahead( World *world, int x, int z );
+void stop_prefetcher( World *world );
+
+// summary.c
+void summarize_section( PyObject *section, unsigned char *ids );
+void summarize_chunk( ChunkSummary *summary, PyObject *dict );
+int candidate_sections( ChunkSummary *summary, int id );
+ChunkSummary *load_summaries( char *path, int x, int z );
+int save_summaries( Region *region, char *path );
+
+// trace.c
+PyObject *minecraft_start_trace( PyObject *self, PyObject *args );
+PyObject *minecraft_stop_trace( PyObject *self );
+PyObject *minecraft_set_trace_callback( PyObject *self, PyObject *args );
 
 // region.c
+int region_end( Region *region );
 int update_region( Region *region, Chunk *chunk );
 int save_region( Region *region, char *path );
 int unload_region( Region *region, char *path );
 void print_region_info( Region *region );
 
 // world.c
-PyTypeObject minecraft_WorldType;
+extern PyTypeObject minecraft_WorldType;
 Region *load_region( World *self, int x, int z );
+int chunk_hash( int x, int z );
+PyObject *get_chunk( World *world, int x, int z );
+int world_block_raw( World *world, int x, int y, int z );
+void put_chunk( World *world, PyObject *chunk );
@@ -10,6 +10,8 @@ Decompression and NBT reading utilities
 #include <stdio.h>
 #include <string.h>
 #include "minecraft.h"
+#include "log.h"
+#include "stats.h"
 #include "tags.h"
 #include "zlib.h"
 
@@ -142,11 +144,15 @@ Inflate
   mode  - compression mode to read
     0   - normal (zlib)
     1   - gzip (including headers)
+  *size - set to the number of bytes inflated, if not NULL
 */
-int inf( unsigned char *dst, unsigned char *src, int bytes, int mode )
+int inf( unsigned char *dst, unsigned char *src, int bytes, int mode, int *size )
 {
     int ret;
     z_stream strm;
+    unsigned long long start;
+
+    start = stats_clock();
 
     strm.zalloc = Z_NULL;
     strm.zfree = Z_NULL;
@@ -161,6 +167,12 @@ int inf( unsigned char *dst, unsigned char *src, int bytes, int mode )
     ret = inflate(&strm, Z_FINISH);
     inflateEnd(&strm);
 
+    STAT_ADD(STAT_INFLATED_BYTES, strm.total_out);
+    STAT_ADD(STAT_ZLIB_NS, stats_clock() - start);
+
+    if( size != NULL )
+        *size = strm.total_out;
+
     if ( ret != Z_STREAM_END )
         PyErr_Format(PyExc_Exception, "Unable to decompress (RC: %d | Error: %s)", ret, strm.msg);
 
@@ -180,6 +192,9 @@ int def( unsigned char *dst, unsigned char *src, int bytes, int mode, int *size
 {
     int ret;
     z_stream strm;
+    unsigned long long start;
+
+    start = stats_clock();
 
     strm.zalloc = Z_NULL;
     strm.zfree = Z_NULL;
@@ -198,6 +213,9 @@ int def( unsigned char *dst, unsigned char *src, int bytes, int mode, int *size
                  Z_DEFAULT_STRATEGY);
     ret = deflate(&strm, Z_FINISH);
     deflateEnd(&strm);
+
+    STAT_ADD(STAT_DEFLATED_BYTES, strm.total_in);
+    STAT_ADD(STAT_ZLIB_NS, stats_clock() - start);
     
     if ( ret != Z_STREAM_END )
         PyErr_Format(PyExc_Exception, "Unable to compress (RC: %d | Error: %s)", ret, strm.msg);
@@ -206,6 +224,99 @@ int def( unsigned char *dst, unsigned char *src, int bytes, int mode, int *size
     return ret;
 }
 
+/*
+Compound tag names, interned the first time they're seen and shared by every
+dictionary get_tag builds after that, instead of copying each name out to a
+C string and making a new Python string from it
+*/
+static PyObject *tag_keys[TAG_KEY_SLOTS];
+
+// Returns a new reference to the interned string for a tag name
+static PyObject *tag_key( char *name, int length )
+{
+    PyObject *key;
+    unsigned int hash;
+    int i;
+
+    hash = 5381;
+    for( i = 0; i < length; i++ )
+        hash = hash * 33 + (unsigned char) name[i];
+
+    for( i = 0; i < TAG_KEY_SLOTS; i++ )
+    {
+        PyObject **slot;
+
+        slot = &tag_keys[(hash + i) & (TAG_KEY_SLOTS - 1)];
+        if( *slot == NULL )
+        {
+            key = PyString_FromStringAndSize(name, length);
+            PyString_InternInPlace(&key);
+            *slot = key; // The table's reference
+            break;
+        }
+
+        if( PyString_GET_SIZE(*slot) == length && memcmp(PyString_AS_STRING(*slot), name, length) == 0 )
+            break;
+    }
+
+    // Full, which takes far more distinct names than any world has
+    if( i == TAG_KEY_SLOTS )
+        return PyString_FromStringAndSize(name, length);
+
+    key = tag_keys[(hash + i) & (TAG_KEY_SLOTS - 1)];
+    Py_INCREF(key);
+    return key;
+}
+
+// The chunk tag names the accessors look up, as interned keys from the table
+PyObject *key_level, *key_sections, *key_y, *key_blocks, *key_add, *key_data;
+PyObject *key_block_light, *key_sky_light, *key_height_map, *key_biomes;
+PyObject *key_x_pos, *key_z_pos, *key_last_update, *key_terrain_populated;
+PyObject *key_entities, *key_tile_entities;
+
+// Keys of compact sections (see palette.c), which are never written as NBT
+PyObject *key_palette, *key_indices;
+
+static PyObject *named_key( char *name )
+{
+    return tag_key(name, strlen(name));
+}
+
+/*
+Interns every name in chunk_tags and leveldat_tags up front, so the decoder
+and the accessors use the same key objects from the first chunk on and
+lookups compare pointers rather than strings
+*/
+void init_tag_keys( void )
+{
+    TagType *type;
+
+    for( type = leveldat_tags; type->name != NULL; type++ )
+        Py_DECREF(named_key(type->name));
+    for( type = chunk_tags; type->name != NULL; type++ )
+        Py_DECREF(named_key(type->name));
+
+    // The table keeps these alive, but the globals hold a reference of their own
+    key_level = named_key("Level");
+    key_sections = named_key("Sections");
+    key_y = named_key("Y");
+    key_blocks = named_key("Blocks");
+    key_add = named_key("Add");
+    key_data = named_key("Data");
+    key_block_light = named_key("BlockLight");
+    key_sky_light = named_key("SkyLight");
+    key_height_map = named_key("HeightMap");
+    key_biomes = named_key("Biomes");
+    key_x_pos = named_key("xPos");
+    key_z_pos = named_key("zPos");
+    key_last_update = named_key("LastUpdate");
+    key_terrain_populated = named_key("TerrainPopulated");
+    key_entities = named_key("Entities");
+    key_tile_entities = named_key("TileEntities");
+    key_palette = named_key("Palette");
+    key_indices = named_key("Indices");
+}
+
 // Given a pointer to a payload, return a PyObject representing that payload
 // moved will be modified by the amount the tag pointer shifted
 PyObject *get_tag( unsigned char *tag, char id, int *moved )
@@ -319,9 +430,8 @@ PyObject *get_tag( unsigned char *tag, char id, int *moved )
             payload = PyDict_New();
             do // Repeatedly grab tags until an end tag is seen 
             {
-                PyObject *sub_payload;
+                PyObject *sub_payload, *key;
                 unsigned char sub_id;
-                char *sub_tag_name;
                 int sub_tag_name_length;
 
                 sub_id = *tag;
@@ -337,25 +447,23 @@ PyObject *get_tag( unsigned char *tag, char id, int *moved )
                 if( sub_tag_name_length == 0 )
                     return NULL; 
 
-                sub_tag_name = calloc(sub_tag_name_length + 1, 1);
-                strncpy(sub_tag_name, (char *) tag + 3, sub_tag_name_length);
-                // printf("Tag ID: %d | Name: %.*s\n", sub_id, sub_tag_name_length, sub_tag_name);
+                key = tag_key((char *) tag + 3, sub_tag_name_length);
+                // printf("Tag ID: %d | Name: %.*s\n", sub_id, sub_tag_name_length, tag + 3);
 
                 tag += 3 + sub_tag_name_length;
                 sub_moved = 0;
                 sub_payload = get_tag(tag, sub_id, &sub_moved);
-                PyDict_SetItemString(payload, sub_tag_name, sub_payload);
+                PyDict_SetItem(payload, key, sub_payload);
+                Py_DECREF(key);
 
                 tag += sub_moved;
                 *moved += 3 + sub_tag_name_length + sub_moved;
-
-                free(sub_tag_name);
             }
             while( true );
             break;           
 
         default:
-            printf("UNCAUGHT TAG ID: %d\n", id);
+            log_warning("Uncaught tag ID: %d", id);
             return NULL;
     }
 
@@ -373,6 +481,9 @@ returns
 int write_tags( unsigned char *dst, PyObject *dict, TagType tags[] )
 {
     int moved;
+    unsigned long long start;
+
+    start = stats_clock();
 
     // Write the root compound tag
     memset(dst, TAG_COMPOUND, 1);
@@ -386,6 +497,7 @@ int write_tags( unsigned char *dst, PyObject *dict, TagType tags[] )
     // Write the end tag
     memset(dst, 0, 1);
 
+    STAT_ADD(STAT_NBT_WRITE_NS, stats_clock() - start);
     return moved + 4; // Size of subtags + 4 bytes for root tag
 }
 
@@ -505,6 +617,7 @@ int write_tags_payload( unsigned char *dst, TagType tag_info, PyObject *payload,
             if( size == 0 && tag_info.empty_byte_list )
             {
                 *dst = TAG_BYTE_ARRAY; 
+                memset(dst + 1, 0, 4);
                 *moved += 5; // 1 + 4 for the empty byte array
                 break;
             }
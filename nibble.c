@@ -0,0 +1,216 @@
+/*
+nibble.c
+
+Bulk kernels for the 4-bit arrays sections store (Add, Data, BlockLight and
+SkyLight), where element i lives in the low nibble of byte i / 2 when i is
+even and the high nibble when it's odd.  Rather than poking at nibbles one at
+a time, bulk code expands an array to one byte per element, works on bytes,
+and packs the result back.
+
+When SSE2 is available the kernels handle 32 elements per step, falling back
+to scalar code for any remainder (and everywhere on other architectures).
+Counts are in elements and must be even.
+*/
+
+#include <Python.h>
+#include <stdbool.h>
+#include <string.h>
+#include "minecraft.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Expand count nibbles from src into one byte each in dst
+void unpack_nibbles( const unsigned char *src, unsigned char *dst, int count )
+{
+    int i;
+
+    i = 0;
+#if defined(__SSE2__)
+    {
+        __m128i low_mask;
+
+        low_mask = _mm_set1_epi8(0x0F);
+        for( ; i + 32 <= count; i += 32 )
+        {
+            __m128i packed, low, high;
+
+            packed = _mm_loadu_si128((const __m128i *) (src + (i >> 1)));
+            low = _mm_and_si128(packed, low_mask);
+            high = _mm_and_si128(_mm_srli_epi16(packed, 4), low_mask);
+            _mm_storeu_si128((__m128i *) (dst + i), _mm_unpacklo_epi8(low, high));
+            _mm_storeu_si128((__m128i *) (dst + i + 16), _mm_unpackhi_epi8(low, high));
+        }
+    }
+#endif
+
+    for( ; i < count; i += 2 )
+    {
+        dst[i] = src[i >> 1] & 0x0F;
+        dst[i + 1] = src[i >> 1] >> 4;
+    }
+}
+
+// Pack the low 4 bits of count bytes from src into nibbles in dst
+void pack_nibbles( const unsigned char *src, unsigned char *dst, int count )
+{
+    int i;
+
+    i = 0;
+#if defined(__SSE2__)
+    {
+        __m128i nibble_mask, byte_mask;
+
+        nibble_mask = _mm_set1_epi8(0x0F);
+        byte_mask = _mm_set1_epi16(0x00FF);
+        for( ; i + 32 <= count; i += 32 )
+        {
+            __m128i a, b;
+
+            // Each 16-bit lane holds an even element in its low byte and an
+            // odd one in its high byte; fold the odd one down next to it
+            a = _mm_and_si128(_mm_loadu_si128((const __m128i *) (src + i)), nibble_mask);
+            b = _mm_and_si128(_mm_loadu_si128((const __m128i *) (src + i + 16)), nibble_mask);
+            a = _mm_and_si128(_mm_or_si128(a, _mm_srli_epi16(a, 4)), byte_mask);
+            b = _mm_and_si128(_mm_or_si128(b, _mm_srli_epi16(b, 4)), byte_mask);
+            _mm_storeu_si128((__m128i *) (dst + (i >> 1)), _mm_packus_epi16(a, b));
+        }
+    }
+#endif
+
+    for( ; i < count; i += 2 )
+        dst[i >> 1] = (src[i] & 0x0F) | (src[i + 1] & 0x0F) << 4;
+}
+
+// Set dst[i] to value wherever mask[i] is 0xFF (mask bytes are 0x00 or 0xFF)
+void set_bytes_masked( unsigned char *dst, const unsigned char *mask, unsigned char value, int count )
+{
+    int i;
+
+    i = 0;
+#if defined(__SSE2__)
+    {
+        __m128i fill;
+
+        fill = _mm_set1_epi8((char) value);
+        for( ; i + 16 <= count; i += 16 )
+        {
+            __m128i selected, existing;
+
+            selected = _mm_loadu_si128((const __m128i *) (mask + i));
+            existing = _mm_loadu_si128((const __m128i *) (dst + i));
+            existing = _mm_or_si128(_mm_and_si128(selected, fill), _mm_andnot_si128(selected, existing));
+            _mm_storeu_si128((__m128i *) (dst + i), existing);
+        }
+    }
+#endif
+
+    for( ; i < count; i++ )
+        dst[i] = (dst[i] & ~mask[i]) | (value & mask[i]);
+}
+
+// Set nibble i of array to value wherever mask[i] is 0xFF
+void set_nibbles_masked( unsigned char *array, const unsigned char *mask, unsigned char value, int count )
+{
+    int i;
+
+    value &= 0x0F;
+    i = 0;
+#if defined(__SSE2__)
+    {
+        __m128i nibble_mask, byte_mask, fill;
+
+        nibble_mask = _mm_set1_epi8(0x0F);
+        byte_mask = _mm_set1_epi16(0x00FF);
+        fill = _mm_set1_epi8((char) (value | value << 4));
+        for( ; i + 32 <= count; i += 32 )
+        {
+            __m128i a, b, selected, existing;
+
+            // Pack the byte mask down to a nibble mask, the same way as
+            // pack_nibbles
+            a = _mm_and_si128(_mm_loadu_si128((const __m128i *) (mask + i)), nibble_mask);
+            b = _mm_and_si128(_mm_loadu_si128((const __m128i *) (mask + i + 16)), nibble_mask);
+            a = _mm_and_si128(_mm_or_si128(a, _mm_srli_epi16(a, 4)), byte_mask);
+            b = _mm_and_si128(_mm_or_si128(b, _mm_srli_epi16(b, 4)), byte_mask);
+            selected = _mm_packus_epi16(a, b);
+
+            existing = _mm_loadu_si128((const __m128i *) (array + (i >> 1)));
+            existing = _mm_or_si128(_mm_and_si128(selected, fill), _mm_andnot_si128(selected, existing));
+            _mm_storeu_si128((__m128i *) (array + (i >> 1)), existing);
+        }
+    }
+#endif
+
+    for( ; i < count; i += 2 )
+    {
+        unsigned char selected;
+
+        selected = (mask[i] & 0x0F) | (mask[i + 1] & 0xF0);
+        array[i >> 1] = (array[i >> 1] & ~selected) | ((value | value << 4) & selected);
+    }
+}
+
+/*
+Compare count block IDs, made from blocks and (if not NULL) the Add nibbles,
+against id, writing 0xFF to mask where they match and 0x00 elsewhere.
+Returns the number of matches.
+*/
+int match_ids( const unsigned char *blocks, const unsigned char *add, int id, unsigned char *mask, int count )
+{
+    int i, matches;
+
+    // Without Add, IDs above 255 can't be there at all
+    if( add == NULL && id >> 8 != 0 )
+    {
+        memset(mask, 0, count);
+        return 0;
+    }
+
+    i = matches = 0;
+#if defined(__SSE2__)
+    {
+        __m128i low_id, high_id, low_mask;
+
+        low_id = _mm_set1_epi8((char) (id & 0xFF));
+        high_id = _mm_set1_epi8((char) (id >> 8));
+        low_mask = _mm_set1_epi8(0x0F);
+        for( ; i + 32 <= count; i += 32 )
+        {
+            __m128i a, b;
+
+            a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (blocks + i)), low_id);
+            b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (blocks + i + 16)), low_id);
+            if( add != NULL )
+            {
+                __m128i packed, low, high;
+
+                packed = _mm_loadu_si128((const __m128i *) (add + (i >> 1)));
+                low = _mm_and_si128(packed, low_mask);
+                high = _mm_and_si128(_mm_srli_epi16(packed, 4), low_mask);
+                a = _mm_and_si128(a, _mm_cmpeq_epi8(_mm_unpacklo_epi8(low, high), high_id));
+                b = _mm_and_si128(b, _mm_cmpeq_epi8(_mm_unpackhi_epi8(low, high), high_id));
+            }
+
+            _mm_storeu_si128((__m128i *) (mask + i), a);
+            _mm_storeu_si128((__m128i *) (mask + i + 16), b);
+            matches += __builtin_popcount(_mm_movemask_epi8(a) | _mm_movemask_epi8(b) << 16);
+        }
+    }
+#endif
+
+    for( ; i < count; i++ )
+    {
+        int current;
+
+        current = blocks[i];
+        if( add != NULL )
+            current |= ((add[i >> 1] >> ((i & 1) << 2)) & 0x0F) << 8;
+
+        mask[i] = current == id ? 0xFF : 0x00;
+        matches += current == id;
+    }
+
+    return matches;
+}
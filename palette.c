@@ -0,0 +1,371 @@
+/*
+palette.c
+
+Compact sections.  Most sections hold only a handful of distinct blocks, so
+rather than five flat arrays (Blocks, Add, Data, BlockLight and SkyLight,
+10 KB with Add) a section can keep a palette of the packed blocks it contains
+(see PACK_BLOCK) and one index into it per block, bit-packed at 1, 2, 4 or 8
+bits.  A compact section's dictionary holds "Palette", a bytearray of native
+unsigned ints, and "Indices" in place of the flat arrays.
+
+A section that is one block throughout (all air above the terrain, or all
+stone below it) is uniform: its palette has a single entry and it has no
+Indices at all.  In a world that compacts its chunks, new sections start out
+uniform where they can, and fills and scans deal with uniform sections
+whole, without expanding them.
+
+Reads go through the palette directly.  Anything that wants the flat arrays
+(get_section and get_chunk_arrays, and so every write, fill and lighting
+pass) expands the section back first.  Compact sections never reach NBT:
+update_region writes a copy of the chunk with them expanded.
+*/
+
+#include <Python.h>
+#include <stdbool.h>
+#include <string.h>
+#include "minecraft.h"
+
+#define NIBBLE(array, i) (((array)[(i) >> 1] >> (((i) & 1) << 2)) & 0x0F)
+
+static unsigned char *section_bytes( PyObject *section, PyObject *key )
+{
+    PyObject *array;
+
+    array = PyDict_GetItem(section, key);
+    return array == NULL ? NULL : (unsigned char *) PyByteArray_AsString(array);
+}
+
+static int section_bytes_size( PyObject *section, PyObject *key )
+{
+    PyObject *array;
+
+    array = PyDict_GetItem(section, key);
+    return array == NULL ? 0 : PyByteArray_Size(array);
+}
+
+static void remove_key( PyObject *section, PyObject *key )
+{
+    if( PyDict_GetItem(section, key) != NULL )
+        PyDict_DelItem(section, key);
+}
+
+// Smallest width, of those that never straddle a byte, that can index size entries
+static int index_bits( int size )
+{
+    if( size == 1 )
+        return 0;
+    if( size <= 2 )
+        return 1;
+    if( size <= 4 )
+        return 2;
+    if( size <= 16 )
+        return 4;
+    return 8;
+}
+
+bool is_compact( PyObject *section )
+{
+    return PyDict_GetItem(section, key_palette) != NULL;
+}
+
+bool is_uniform( PyObject *section )
+{
+    return PyDict_GetItem(section, key_palette) != NULL && PyDict_GetItem(section, key_indices) == NULL;
+}
+
+// Whether a compact section has a block with ID id anywhere in it
+bool palette_holds( PyObject *section, int id )
+{
+    PyObject *array;
+    unsigned int *palette;
+    int i, size;
+
+    array = PyDict_GetItem(section, key_palette);
+    palette = (unsigned int *) PyByteArray_AsString(array);
+    size = PyByteArray_Size(array) / sizeof(unsigned int);
+    for( i = 0; i < size; i++ )
+        if( (int) (palette[i] & 0xFFF) == id )
+            return true;
+
+    return false;
+}
+
+// Makes every block in a section the packed block value, dropping its arrays
+void make_uniform( PyObject *section, unsigned int packed )
+{
+    PyObject *new;
+
+    new = PyByteArray_FromStringAndSize((char *) &packed, sizeof(unsigned int));
+    PyDict_SetItem(section, key_palette, new);
+    Py_DECREF(new);
+
+    remove_key(section, key_indices);
+    remove_key(section, key_blocks);
+    remove_key(section, key_add);
+    remove_key(section, key_data);
+    remove_key(section, key_block_light);
+    remove_key(section, key_sky_light);
+}
+
+// Packed block at position (y * 256 + z * 16 + x) in a compact section
+int compact_block_raw( PyObject *section, int position )
+{
+    unsigned int *palette;
+    unsigned char *indices;
+    int bits, index;
+
+    palette = (unsigned int *) section_bytes(section, key_palette);
+    indices = section_bytes(section, key_indices);
+    if( indices == NULL )
+        return palette[0];
+    bits = section_bytes_size(section, key_indices) / 512;
+
+    index = (indices[position * bits >> 3] >> (position * bits & 7)) & ((1 << bits) - 1);
+    return palette[index];
+}
+
+/*
+Replaces a section's flat arrays with a palette and indices, if the section
+has few enough distinct blocks for that to be smaller.  Returns the number of
+bytes of array storage saved, which is 0 if the section was left as it was.
+*/
+int compact_section( PyObject *section )
+{
+    unsigned char *blocks, *add, *data, *blocklight, *skylight, *indices, *packed_indices;
+    unsigned int palette[PALETTE_MAX];
+    short slots[PALETTE_HASH_SLOTS];
+    int i, size, bits, before, after;
+    PyObject *new;
+    size_t mark;
+
+    blocks = section_bytes(section, key_blocks);
+    if( blocks == NULL || is_compact(section) )
+        return 0;
+
+    add = section_bytes(section, key_add);
+    data = section_bytes(section, key_data);
+    blocklight = section_bytes(section, key_block_light);
+    skylight = section_bytes(section, key_sky_light);
+
+    mark = arena_mark();
+    indices = arena_alloc(4096);
+
+    // Gather the distinct blocks, hashing them to find ones already seen
+    memset(slots, -1, sizeof(slots));
+    size = 0;
+    for( i = 0; i < 4096; i++ )
+    {
+        unsigned int packed, slot;
+
+        packed = PACK_BLOCK(blocks[i] | (add != NULL ? NIBBLE(add, i) << 8 : 0),
+                            data != NULL ? NIBBLE(data, i) : 0,
+                            blocklight != NULL ? NIBBLE(blocklight, i) : 0,
+                            skylight != NULL ? NIBBLE(skylight, i) : 0);
+
+        slot = (packed * 2654435761u) >> (32 - PALETTE_HASH_BITS);
+        while( slots[slot] != -1 && palette[slots[slot]] != packed )
+            slot = (slot + 1) & (PALETTE_HASH_SLOTS - 1);
+
+        if( slots[slot] == -1 )
+        {
+            // Too varied to be worth it
+            if( size == PALETTE_MAX )
+            {
+                arena_release(mark);
+                return 0;
+            }
+            palette[size] = packed;
+            slots[slot] = size++;
+        }
+        indices[i] = slots[slot];
+    }
+
+    bits = index_bits(size);
+    before = section_bytes_size(section, key_blocks) + section_bytes_size(section, key_add) +
+             section_bytes_size(section, key_data) + section_bytes_size(section, key_block_light) +
+             section_bytes_size(section, key_sky_light);
+    after = 4096 * bits / 8 + size * sizeof(unsigned int);
+    if( after >= before )
+    {
+        arena_release(mark);
+        return 0;
+    }
+
+    if( bits == 0 )
+    {
+        make_uniform(section, palette[0]);
+        arena_release(mark);
+        return before - after;
+    }
+
+    new = PyByteArray_FromStringAndSize(NULL, 4096 * bits / 8);
+    packed_indices = (unsigned char *) PyByteArray_AsString(new);
+    memset(packed_indices, 0, 4096 * bits / 8);
+    for( i = 0; i < 4096; i++ )
+        packed_indices[i * bits >> 3] |= indices[i] << (i * bits & 7);
+    PyDict_SetItem(section, key_indices, new);
+    Py_DECREF(new);
+
+    new = PyByteArray_FromStringAndSize((char *) palette, size * sizeof(unsigned int));
+    PyDict_SetItem(section, key_palette, new);
+    Py_DECREF(new);
+
+    remove_key(section, key_blocks);
+    remove_key(section, key_add);
+    remove_key(section, key_data);
+    remove_key(section, key_block_light);
+    remove_key(section, key_sky_light);
+
+    arena_release(mark);
+    return before - after;
+}
+
+// Adds a flat array to a section, every byte set to value
+static unsigned char *new_array( PyObject *section, PyObject *key, int size, int value )
+{
+    PyObject *new;
+    unsigned char *array;
+
+    new = PyByteArray_FromStringAndSize(NULL, size);
+    array = (unsigned char *) PyByteArray_AsString(new);
+    memset(array, value, size);
+    PyDict_SetItem(section, key, new);
+    Py_DECREF(new);
+
+    return array;
+}
+
+// Turns a compact section back into flat arrays, leaving others alone
+void expand_section( PyObject *section )
+{
+    unsigned char *blocks, *add, *data, *blocklight, *skylight;
+    unsigned int *palette;
+    int i, size;
+    bool high;
+
+    if( !is_compact(section) )
+        return;
+
+    palette = (unsigned int *) section_bytes(section, key_palette);
+    size = section_bytes_size(section, key_palette) / sizeof(unsigned int);
+
+    // Add only comes back if some block needs it
+    high = false;
+    for( i = 0; i < size; i++ )
+        high |= (palette[i] & 0xF00) != 0;
+
+    if( is_uniform(section) )
+    {
+        unsigned int packed;
+
+        // Every nibble the same means every byte the same
+        packed = palette[0];
+        new_array(section, key_blocks, 4096, packed & 0xFF);
+        if( high )
+            new_array(section, key_add, 2048, ((packed >> 8) & 0x0F) * 0x11);
+        new_array(section, key_data, 2048, ((packed >> 12) & 0x0F) * 0x11);
+        new_array(section, key_block_light, 2048, ((packed >> 16) & 0x0F) * 0x11);
+        new_array(section, key_sky_light, 2048, ((packed >> 20) & 0x0F) * 0x11);
+        remove_key(section, key_palette);
+        return;
+    }
+
+    blocks = new_array(section, key_blocks, 4096, 0);
+    add = high ? new_array(section, key_add, 2048, 0) : NULL;
+    data = new_array(section, key_data, 2048, 0);
+    blocklight = new_array(section, key_block_light, 2048, 0);
+    skylight = new_array(section, key_sky_light, 2048, 0);
+
+    for( i = 0; i < 4096; i++ )
+    {
+        unsigned int packed;
+        int shift;
+
+        packed = compact_block_raw(section, i);
+        shift = (i & 1) << 2;
+
+        blocks[i] = packed & 0xFF;
+        if( add != NULL )
+            add[i >> 1] |= ((packed >> 8) & 0x0F) << shift;
+        data[i >> 1] |= ((packed >> 12) & 0x0F) << shift;
+        blocklight[i >> 1] |= ((packed >> 16) & 0x0F) << shift;
+        skylight[i >> 1] |= ((packed >> 20) & 0x0F) << shift;
+    }
+
+    remove_key(section, key_palette);
+    remove_key(section, key_indices);
+}
+
+/*
+Compacts every section of a chunk that would shrink, returning the bytes
+saved.  Sections expand again as they're written to.
+*/
+int compact_chunk( Chunk *chunk )
+{
+    PyObject *level, *sections;
+    int i, size, saved;
+
+    level = PyDict_GetItem(chunk->dict, key_level);
+    sections = level == NULL ? NULL : PyDict_GetItem(level, key_sections);
+    if( sections == NULL )
+        return 0;
+
+    saved = 0;
+    size = PyList_Size(sections);
+    for( i = 0; i < size; i++ )
+        saved += compact_section(PyList_GetItem(sections, i));
+
+    return saved;
+}
+
+/*
+The chunk dictionary as it should be written out: the dictionary itself if
+no section is compact, or else a copy sharing everything but the compact
+sections, which are expanded.  Returns a new reference.
+*/
+PyObject *expanded_chunk_dict( PyObject *dict )
+{
+    PyObject *level, *sections, *copy, *level_copy, *sections_copy;
+    int i, size;
+    bool any;
+
+    level = PyDict_GetItem(dict, key_level);
+    sections = level == NULL ? NULL : PyDict_GetItem(level, key_sections);
+
+    any = false;
+    size = sections == NULL ? 0 : PyList_Size(sections);
+    for( i = 0; i < size && !any; i++ )
+        any = is_compact(PyList_GetItem(sections, i));
+
+    if( !any )
+    {
+        Py_INCREF(dict);
+        return dict;
+    }
+
+    sections_copy = PyList_New(size);
+    for( i = 0; i < size; i++ )
+    {
+        PyObject *section;
+
+        section = PyList_GetItem(sections, i);
+        if( is_compact(section) )
+        {
+            section = PyDict_Copy(section);
+            expand_section(section);
+        }
+        else
+            Py_INCREF(section);
+        PyList_SET_ITEM(sections_copy, i, section);
+    }
+
+    level_copy = PyDict_Copy(level);
+    PyDict_SetItem(level_copy, key_sections, sections_copy);
+    Py_DECREF(sections_copy);
+
+    copy = PyDict_Copy(dict);
+    PyDict_SetItem(copy, key_level, level_copy);
+    Py_DECREF(level_copy);
+
+    return copy;
+}
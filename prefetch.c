@@ -0,0 +1,284 @@
+/*
+prefetch.c
+
+Background reading of region files.  Regions asked for with prefetch_region
+are read into memory by a worker thread, and load_region picks the finished
+buffer up instead of reading the file itself, so the I/O overlaps with
+whatever the caller is doing in the meantime.  load_region also reads ahead
+on its own: once two neighbouring regions have been loaded one after the
+other, the next region along the same direction is prefetched.
+*/
+
+#include <Python.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "minecraft.h"
+
+enum { SLOT_EMPTY, SLOT_PENDING, SLOT_READING, SLOT_READY, SLOT_FAILED };
+
+static void read_slot( Prefetcher *prefetcher, PrefetchSlot *slot )
+{
+    FILE *fp;
+    struct stat st;
+    char filename[1000]; // TODO: Dynamic
+    unsigned char *buffer;
+    int x, z, state, size;
+
+    x = slot->x;
+    z = slot->z;
+    buffer = NULL;
+    size = 0;
+    state = SLOT_FAILED;
+
+    // The lock isn't held while reading; the slot is ours while it's
+    // marked as being read
+    pthread_mutex_unlock(&prefetcher->lock);
+
+    sprintf(filename, "%s/region/r.%d.%d.mca", prefetcher->path, x, z);
+    fp = fopen(filename, "rb");
+    if( fp != NULL )
+    {
+        if( fstat(fileno(fp), &st) == 0 )
+        {
+            size = st.st_size;
+            buffer = calloc(size + REGION_BUFFER_PADDING, 1);
+            if( buffer != NULL && fread(buffer, 1, size, fp) == (size_t) size )
+                state = SLOT_READY;
+        }
+        fclose(fp);
+    }
+
+    if( state != SLOT_READY )
+    {
+        free(buffer);
+        buffer = NULL;
+    }
+
+    pthread_mutex_lock(&prefetcher->lock);
+    slot->buffer = buffer;
+    slot->size = size;
+    slot->state = state;
+    pthread_cond_broadcast(&prefetcher->changed);
+}
+
+static void *prefetch_worker( void *arg )
+{
+    Prefetcher *prefetcher;
+
+    prefetcher = (Prefetcher *) arg;
+    pthread_mutex_lock(&prefetcher->lock);
+    while( !prefetcher->stop )
+    {
+        PrefetchSlot *next;
+        int i;
+
+        // Oldest request first
+        next = NULL;
+        for( i = 0; i < PREFETCH_SLOTS; i++ )
+            if( prefetcher->slots[i].state == SLOT_PENDING &&
+                (next == NULL || prefetcher->slots[i].sequence < next->sequence) )
+                next = &prefetcher->slots[i];
+
+        if( next == NULL )
+        {
+            pthread_cond_wait(&prefetcher->changed, &prefetcher->lock);
+            continue;
+        }
+
+        next->state = SLOT_READING;
+        read_slot(prefetcher, next);
+    }
+    pthread_mutex_unlock(&prefetcher->lock);
+
+    return NULL;
+}
+
+static Prefetcher *get_prefetcher( World *world )
+{
+    Prefetcher *prefetcher;
+
+    if( world->prefetcher != NULL )
+        return world->prefetcher;
+
+    prefetcher = calloc(1, sizeof(Prefetcher));
+    prefetcher->path = strdup(world->path);
+    pthread_mutex_init(&prefetcher->lock, NULL);
+    pthread_cond_init(&prefetcher->changed, NULL);
+    if( pthread_create(&prefetcher->thread, NULL, prefetch_worker, prefetcher) != 0 )
+    {
+        pthread_cond_destroy(&prefetcher->changed);
+        pthread_mutex_destroy(&prefetcher->lock);
+        free(prefetcher->path);
+        free(prefetcher);
+        return NULL;
+    }
+
+    world->prefetcher = prefetcher;
+    return prefetcher;
+}
+
+/*
+Queue a region to be read in the background, unless it's already in memory
+or on its way.  Requests are dropped, rather than waiting, if every slot is
+busy.  Returns true if the region was queued (or already was).
+*/
+bool prefetch_region( World *world, int x, int z )
+{
+    Prefetcher *prefetcher;
+    Region *region;
+    PrefetchSlot *free_slot;
+    char filename[1000]; // TODO: Dynamic
+    struct stat st;
+    int i;
+
+    for( region = world->regions; region != NULL; region = region->next )
+        if( region->x == x && region->z == z )
+            return true;
+    // A region being saved is read back from memory, not its file
+    for( region = world->saving; region != NULL; region = region->next )
+        if( region->x == x && region->z == z )
+            return true;
+
+    sprintf(filename, "%s/region/r.%d.%d.mca", world->path, x, z);
+    if( stat(filename, &st) != 0 )
+        return false;
+
+    if( (prefetcher = get_prefetcher(world)) == NULL )
+        return false;
+
+    pthread_mutex_lock(&prefetcher->lock);
+    free_slot = NULL;
+    for( i = 0; i < PREFETCH_SLOTS; i++ )
+    {
+        PrefetchSlot *slot;
+
+        slot = &prefetcher->slots[i];
+        if( slot->state != SLOT_EMPTY && slot->x == x && slot->z == z )
+        {
+            pthread_mutex_unlock(&prefetcher->lock);
+            return true;
+        }
+
+        // Prefer an unused slot, but finished reads nobody picked up can
+        // make way for new ones, oldest first
+        if( slot->state == SLOT_EMPTY || slot->state == SLOT_FAILED )
+        {
+            if( free_slot == NULL || free_slot->state == SLOT_READY )
+                free_slot = slot;
+        }
+        else if( slot->state == SLOT_READY &&
+                 (free_slot == NULL || (free_slot->state == SLOT_READY && slot->sequence < free_slot->sequence)) )
+            free_slot = slot;
+    }
+
+    if( free_slot != NULL )
+    {
+        free(free_slot->buffer);
+        free_slot->buffer = NULL;
+        free_slot->x = x;
+        free_slot->z = z;
+        free_slot->sequence = ++prefetcher->sequence;
+        free_slot->state = SLOT_PENDING;
+        pthread_cond_broadcast(&prefetcher->changed);
+    }
+    pthread_mutex_unlock(&prefetcher->lock);
+
+    return free_slot != NULL;
+}
+
+/*
+Hand over the buffer for a prefetched region, waiting (without the GIL) for
+the read if it's still in progress.  Returns true and fills in buffer (which
+the caller then owns, with REGION_BUFFER_PADDING spare bytes at the end) and
+size, or false if the region wasn't prefetched or couldn't be read.
+*/
+bool take_prefetched( World *world, int x, int z, unsigned char **buffer, int *size )
+{
+    Prefetcher *prefetcher;
+    PrefetchSlot *slot;
+    bool found;
+    int i;
+
+    prefetcher = world->prefetcher;
+    if( prefetcher == NULL )
+        return false;
+
+    found = false;
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&prefetcher->lock);
+
+    slot = NULL;
+    for( i = 0; i < PREFETCH_SLOTS; i++ )
+        if( prefetcher->slots[i].state != SLOT_EMPTY && prefetcher->slots[i].x == x && prefetcher->slots[i].z == z )
+            slot = &prefetcher->slots[i];
+
+    if( slot != NULL )
+    {
+        while( slot->state == SLOT_PENDING || slot->state == SLOT_READING )
+            pthread_cond_wait(&prefetcher->changed, &prefetcher->lock);
+
+        if( slot->state == SLOT_READY )
+        {
+            *buffer = slot->buffer;
+            *size = slot->size;
+            found = true;
+        }
+        slot->buffer = NULL;
+        slot->state = SLOT_EMPTY;
+    }
+
+    pthread_mutex_unlock(&prefetcher->lock);
+    Py_END_ALLOW_THREADS
+
+    return found;
+}
+
+/*
+Called by load_region whenever a region comes in from disk: if it continues a
+walk from the previous one in a straight line, start reading the next
+*/
+void read_ahead( World *world, int x, int z )
+{
+    int dx, dz;
+
+    dx = x - world->last_region_x;
+    dz = z - world->last_region_z;
+    if( world->read_ahead && world->has_last_region && abs(dx) + abs(dz) == 1 )
+        prefetch_region(world, x + dx, z + dz);
+
+    world->last_region_x = x;
+    world->last_region_z = z;
+    world->has_last_region = true;
+}
+
+// Stop the worker thread and free anything it read that was never used
+void stop_prefetcher( World *world )
+{
+    Prefetcher *prefetcher;
+    int i;
+
+    prefetcher = world->prefetcher;
+    if( prefetcher == NULL )
+        return;
+
+    pthread_mutex_lock(&prefetcher->lock);
+    prefetcher->stop = true;
+    pthread_cond_broadcast(&prefetcher->changed);
+    pthread_mutex_unlock(&prefetcher->lock);
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_join(prefetcher->thread, NULL);
+    Py_END_ALLOW_THREADS
+
+    for( i = 0; i < PREFETCH_SLOTS; i++ )
+        free(prefetcher->slots[i].buffer);
+    pthread_cond_destroy(&prefetcher->changed);
+    pthread_mutex_destroy(&prefetcher->lock);
+    free(prefetcher->path);
+    free(prefetcher);
+    world->prefetcher = NULL;
+}
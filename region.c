@@ -10,11 +10,35 @@ Functions to writing to region files, mostly to be used by chunks when saving
 #include <stdio.h>
 #include <string.h>
 #include "minecraft.h"
+#include "log.h"
+#include "stats.h"
 #include "tags.h"
 
 void print_region_info( Region *region )
 {
-    printf("Region | X: %d Z: %d\nCurrent Size: %d | Buffer Size: %d\nBuffer: %p\nNext: %p\n", region->x, region->z, region->current_size, region->buffer_size, region->buffer, region->next);
+    log_debug("Region | X: %d Z: %d | Current Size: %d | Buffer Size: %d | Buffer: %p | Next: %p", region->x, region->z, region->current_size, region->buffer_size, region->buffer, region->next);
+}
+
+// Returns the sector just past the last chunk in the region, which is never
+// less than 2 (the location and timestamp tables)
+int region_end( Region *region )
+{
+    int i, end;
+
+    end = 2;
+    for( i = 0; i < 4096; i += 4 )
+    {
+        int current_end;
+
+        if( region->buffer[i + 3] == 0 )
+            continue;
+
+        current_end = swap_endianness(region->buffer + i, 3) + region->buffer[i + 3];
+        if( current_end > end )
+            end = current_end;
+    }
+
+    return end;
 }
 
 // Takes a region buffer, and updates it with a chunk, with the assumptions
@@ -22,8 +46,14 @@ void print_region_info( Region *region )
 // is large enough to handle a previusly-empty chunk being written to the end
 int update_region( Region *region, Chunk *chunk )
 {
-    int i, location, offset, timestamp, last_offset, uncompressed_size, compressed_size, difference, new_sector_count;
-    unsigned char sector_count, last_sector_count, *uncompressed_chunk, *compressed_chunk;
+    int i, location, offset, end, uncompressed_size, compressed_size, difference, new_sector_count, required_size;
+    unsigned char sector_count, *uncompressed_chunk, *compressed_chunk;
+    PyObject *dict;
+    unsigned long long start;
+    size_t mark;
+
+    start = stats_clock();
+    mark = arena_mark();
 
     offset = 4 * ((chunk->x & 31) + (chunk->z & 31) * 32);
     location = swap_endianness(region->buffer + offset, 3);
@@ -32,75 +62,73 @@ int update_region( Region *region, Chunk *chunk )
     // TODO: Update timestamp, if desired
     // timestamp = swap_endianness(region->buffer + offset + 4096, 4);
 
-    // Find the last offset in the file, both so we can know the end if we
-    // need to move memory to insert extra chunk sectors, and so we can append
-    // to the end if the chunk was previously empty
-    last_offset = 2;
-    last_sector_count = 0;
-    for( i = 0; i < 4096; i += 4 )
-    {
-        int current_offset;
-        unsigned char current_sector_count;
+    // Find the end of the last chunk in the file, both so we can know the end
+    // if we need to move memory to insert extra chunk sectors, and so we can
+    // append to the end if the chunk was previously empty
+    end = region_end(region);
+    log_debug("Region End: %d", end);
 
-        current_offset = swap_endianness(region->buffer + i, 3);
-        current_sector_count = region->buffer[i + 3];
-        if( current_offset > last_offset && current_sector_count != 0 )
-        {
-            last_offset = current_offset;
-            last_sector_count = current_sector_count;
-        }
-    }
-    printf("Last Offset: %d | Sector Count: %d\n", last_offset, last_sector_count);
+    // Whatever was cached for the chunk no longer matches the region
+    if( chunk->world != NULL )
+        cache_invalidate(&((World *) chunk->world)->cache, chunk->x, chunk->z);
 
     // Write out the chunk to a temporary buffer, as a staging ground
-    uncompressed_chunk = malloc(1000000);
-    uncompressed_size = write_tags(uncompressed_chunk, chunk->dict, chunk_tags);
-    printf("Chunk (size %d) written to intermediate buffer!\n", uncompressed_size);
+    // (with any compact sections expanded, since they have no NBT form)
+    uncompressed_chunk = arena_alloc(CHUNK_BUFFER_SIZE);
+    dict = expanded_chunk_dict(chunk->dict);
+    uncompressed_size = write_tags(uncompressed_chunk, dict, chunk_tags);
+    Py_DECREF(dict);
+    log_debug("Chunk (size %d) written to intermediate buffer", uncompressed_size);
 
     // Compress the chunk, so we know the exact size the chunk will take up in
     // memory and can adjust the buffer size accordingly
-    compressed_chunk = malloc(100000);
+    compressed_chunk = arena_alloc(CHUNK_BUFFER_SIZE);
     compressed_size = 0;
     def(compressed_chunk, uncompressed_chunk, uncompressed_size, 0, &compressed_size);
-    printf("Chunk compressed (size %d) to second intermediate buffer!\n", compressed_size);
+    log_debug("Chunk compressed (size %d) to second intermediate buffer", compressed_size);
    
     // Ensure that the buffer area we have will be big enough for the 
     // compressed chunk, including header
     new_sector_count = (compressed_size + 5 + 4096 - 1) / 4096; // ceil(A / B) = (A + B - 1) / B
     
     difference = new_sector_count - sector_count;
-    printf("Difference: %d\n", difference);
-    if( difference != 0 )
+    log_debug("Difference: %d", difference);
+
+    // Create space, if needed: either for the chunk's growth, or for the whole
+    // chunk if it is being appended
+    required_size = (end + (location == 0 ? new_sector_count : difference)) * 4096;
+    if( required_size > region->buffer_size )
     {
-        // Create space, if needed
-        if( region->current_size + difference * 4096 >= region->buffer_size )
-        {
-            unsigned char *new_region_buffer;
-
-            printf("Buffer is too small, increasing size!\n");
-            // Allocate a new region, with a few extra sectors worth of padding
-            new_region_buffer = malloc(region->current_size + (difference + 4) * 4096);
-
-            // TODO: Optimize, since if the chunk information is being
-            // inserted, chunks after it will be moved in memory again
-            memcpy(new_region_buffer, region->buffer, region->current_size);
-            
-            free(region->buffer);
-            region->buffer = new_region_buffer;
-        }
+        unsigned char *new_region_buffer;
+
+        log_debug("Buffer is too small, increasing size");
+        // Allocate a new region, with a few extra sectors worth of padding
+        new_region_buffer = calloc(required_size + 4 * 4096, 1);
+
+        // TODO: Optimize, since if the chunk information is being
+        // inserted, chunks after it will be moved in memory again
+        memcpy(new_region_buffer, region->buffer, region->current_size);
 
+        free(region->buffer);
+        region->buffer = new_region_buffer;
+        region->buffer_size = required_size + 4 * 4096;
+    }
+
+    if( difference != 0 )
+    {
         // Shift chunks after this chunk after if needed
         if( location != 0 )
         {
             void *next_chunk, *next_chunk_after;
             int num;
 
-            num = (last_offset + last_sector_count - (location + sector_count)) * 4096;
+            num = (end - (location + sector_count)) * 4096;
             next_chunk = region->buffer + (location + sector_count) * 4096;
             next_chunk_after = region->buffer + (location + sector_count + difference) * 4096;
-            printf("Shifting %d bytes worth of chunk data from %p to %p\n", num, next_chunk, next_chunk_after);
+            log_debug("Shifting %d bytes worth of chunk data from %p to %p", num, next_chunk, next_chunk_after);
 
             memmove(next_chunk_after, next_chunk, num);
+            STAT_ADD(STAT_REGION_MOVED_BYTES, num);
 
             // Adjust indices
             for( i = 0; i < 4096; i += 4 )
@@ -120,12 +148,12 @@ int update_region( Region *region, Chunk *chunk )
 
     if( location == 0 && sector_count == 0 )
     {
-        printf("Chunk was previously empty, appending to end of buffer");
-        location = last_offset + last_sector_count;    
+        log_debug("Chunk was previously empty, appending to end of buffer");
+        location = end;
     }
 
     // Update header info in the region file lookup table
-    printf("New Location: %d | New Sector Count: %d\n", location, new_sector_count);
+    log_debug("New Location: %d | New Sector Count: %d", location, new_sector_count);
     memcpy(region->buffer + offset, &location, 3);
     swap_endianness_in_memory(region->buffer + offset, 3);
     *(unsigned char *) (region->buffer + offset + 3) = new_sector_count;
@@ -136,8 +164,16 @@ int update_region( Region *region, Chunk *chunk )
     *(unsigned char *) (region->buffer + location * 4096 + 4) = 2; // Compression type
     memcpy(region->buffer + location * 4096 + 5, compressed_chunk, compressed_size);
 
-    free(compressed_chunk);
-    free(uncompressed_chunk);
+    // The region now ends after its last chunk, padded to a whole sector
+    region->current_size = region_end(region) * 4096;
+    chunk->modified = false;
+    region->modified = true;
+
+    if( region->summaries != NULL )
+        summarize_chunk(&region->summaries[(chunk->x & 31) + (chunk->z & 31) * 32], chunk->dict);
+
+    arena_release(mark);
+    end_span(SPAN_CHUNK_SAVE, start, chunk->x, chunk->z);
 
     return 0;
 }
@@ -151,7 +187,9 @@ int save_region( Region *region, char *path )
 {
     FILE *fp;
     char filename[1000]; // TODO: Dynamic
+    unsigned long long start;
 
+    start = stats_clock();
     sprintf(filename, "%s/region/r.%d.%d.mca", path, region->x, region->z);
     fp = fopen(filename, "wb");
     if( fp == NULL )
@@ -163,7 +201,12 @@ int save_region( Region *region, char *path )
     fwrite(region->buffer, 1, region->current_size, fp); 
     fclose(fp);
 
-    printf("Region saved!\n");
+    // After the region, so the summaries record the file they describe
+    if( region->summaries != NULL )
+        save_summaries(region, path);
+
+    log_info("Region saved to %s", filename);
+    end_span(SPAN_REGION_SAVE, start, region->x, region->z);
 
     return 0;
 }
@@ -181,6 +224,7 @@ int unload_region( Region *region, char *path )
     if( region->next != NULL)
         unload_region(region->next, path); // Could potentially loop
     free(region->buffer);
+    free(region->summaries);
     free(region);
 
     return rc;
@@ -5,12 +5,21 @@ Building the C extension
 
 '''
 
+import os
 from distutils.core import setup, Extension
 
+# Release builds can compile logging out above a level, e.g.
+# LOG_COMPILE_LEVEL=LOG_WARNING python setup.py build_ext
+macros = []
+if 'LOG_COMPILE_LEVEL' in os.environ:
+    macros.append(('LOG_COMPILE_LEVEL', os.environ['LOG_COMPILE_LEVEL']))
+
 setup (name = 'Minecraft',
        version = '1.0',
        description = 'Minecraft extension module',
        ext_modules = [
-            Extension("minecraft", sources = ["minecraft.c", "block.c", "chunk.c", "nbt.c", "region.c", "world.c", "generation/generator.c"])
+            Extension("minecraft", sources = ["minecraft.c", "block.c", "chunk.c", "nbt.c", "light.c", "nibble.c", "edit.c", "region.c", "world.c", "iterator.c", "prefetch.c", "palette.c", "summary.c", "arena.c", "cache.c", "log.c", "stats.c", "trace.c", "generation/generator.c", "generation/noise.c", "generation/terrain.c"],
+                      libraries = ["z", "pthread"],
+                      define_macros = macros)
        ])
 
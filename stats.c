@@ -0,0 +1,202 @@
+/*
+stats.c
+
+Per-thread performance counters and latency histograms (see stats.h), and the
+sums of them that World.stats() and World.latencies() report
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+__thread ThreadStats *thread_stats;
+
+const char *stat_names[STAT_COUNT] = {
+    "region_loads",
+    "region_prefetched",
+    "region_evictions",
+    "cache_hits",
+    "cache_misses",
+    "inflated_bytes",
+    "deflated_bytes",
+    "zlib_ns",
+    "nbt_parse_ns",
+    "nbt_write_ns",
+    "region_moved_bytes",
+    "summary_skips",
+};
+
+const char *span_names[SPAN_COUNT] = {
+    "chunk_load",
+    "chunk_save",
+    "region_load",
+    "region_save",
+};
+
+// Every live thread's block, plus what threads that have exited counted
+static ThreadStats *live_stats;
+static ThreadStats retired_stats;
+static int thread_count;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t stats_key;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+
+static void add_stats( ThreadStats *totals, ThreadStats *stats )
+{
+    int i, j;
+
+    for( i = 0; i < STAT_COUNT; i++ )
+        totals->counters[i] += stats->counters[i];
+    for( i = 0; i < SPAN_COUNT; i++ )
+    {
+        for( j = 0; j < HISTOGRAM_BUCKETS; j++ )
+            totals->histograms[i][j] += stats->histograms[i][j];
+        totals->span_ns[i] += stats->span_ns[i];
+    }
+}
+
+static void clear_stats( ThreadStats *stats )
+{
+    memset(stats->counters, 0, sizeof(stats->counters));
+    memset(stats->histograms, 0, sizeof(stats->histograms));
+    memset(stats->span_ns, 0, sizeof(stats->span_ns));
+}
+
+// Runs as a thread exits: fold its counts into the retired totals
+static void retire_thread_stats( void *data )
+{
+    ThreadStats *stats;
+
+    stats = (ThreadStats *) data;
+    pthread_mutex_lock(&stats_lock);
+    add_stats(&retired_stats, stats);
+
+    if( stats->previous != NULL )
+        stats->previous->next = stats->next;
+    else
+        live_stats = stats->next;
+    if( stats->next != NULL )
+        stats->next->previous = stats->previous;
+    pthread_mutex_unlock(&stats_lock);
+
+    free(stats);
+}
+
+static void create_stats_key( void )
+{
+    pthread_key_create(&stats_key, retire_thread_stats);
+}
+
+// First count on a thread: give it a block of its own
+ThreadStats *register_thread_stats( void )
+{
+    ThreadStats *stats;
+
+    pthread_once(&stats_once, create_stats_key);
+
+    stats = calloc(1, sizeof(ThreadStats));
+    pthread_mutex_lock(&stats_lock);
+    stats->thread_id = ++thread_count;
+    stats->next = live_stats;
+    if( live_stats != NULL )
+        live_stats->previous = stats;
+    live_stats = stats;
+    pthread_mutex_unlock(&stats_lock);
+
+    pthread_setspecific(stats_key, stats);
+    thread_stats = stats;
+    return stats;
+}
+
+// Monotonic time in nanoseconds, for the timing counters
+unsigned long long stats_clock( void )
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+Sums every thread's counters and histograms into totals.  Threads still
+counting may be caught part way through, so the sums are a snapshot rather
+than exact.
+*/
+void read_stats( ThreadStats *totals )
+{
+    ThreadStats *stats;
+
+    pthread_mutex_lock(&stats_lock);
+    clear_stats(totals);
+    add_stats(totals, &retired_stats);
+    for( stats = live_stats; stats != NULL; stats = stats->next )
+        add_stats(totals, stats);
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void reset_stats( void )
+{
+    ThreadStats *stats;
+
+    pthread_mutex_lock(&stats_lock);
+    clear_stats(&retired_stats);
+    for( stats = live_stats; stats != NULL; stats = stats->next )
+        clear_stats(stats);
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+Histogram bucket for a value: values below 2^HISTOGRAM_SUB_BITS get a bucket
+each, and every power of two above that is split into 2^HISTOGRAM_SUB_BITS
+equal buckets
+*/
+int histogram_bucket( unsigned long long value )
+{
+    int exponent;
+
+    if( value < (1 << HISTOGRAM_SUB_BITS) )
+        return value;
+
+    exponent = 63 - __builtin_clzll(value);
+    return ((exponent - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) +
+           ((value >> (exponent - HISTOGRAM_SUB_BITS)) & ((1 << HISTOGRAM_SUB_BITS) - 1));
+}
+
+unsigned long long bucket_lowest( int bucket )
+{
+    int shift;
+
+    if( bucket < (1 << HISTOGRAM_SUB_BITS) )
+        return bucket;
+
+    shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+    return (unsigned long long) ((1 << HISTOGRAM_SUB_BITS) + (bucket & ((1 << HISTOGRAM_SUB_BITS) - 1))) << shift;
+}
+
+unsigned long long bucket_highest( int bucket )
+{
+    if( bucket < (1 << HISTOGRAM_SUB_BITS) )
+        return bucket;
+
+    return bucket_lowest(bucket) + (1ULL << ((bucket >> HISTOGRAM_SUB_BITS) - 1)) - 1;
+}
+
+/*
+Ends a timed operation that began at start (from stats_clock), recording it
+in the operation's histogram and, if tracing is on, as a span at (x, z)
+*/
+void end_span( int span, unsigned long long start, int x, int z )
+{
+    ThreadStats *stats;
+    unsigned long long duration;
+
+    duration = stats_clock() - start;
+    stats = thread_stats != NULL ? thread_stats : register_thread_stats();
+    stats->histograms[span][histogram_bucket(duration)]++;
+    stats->span_ns[span] += duration;
+
+    if( tracing )
+        trace_span(span, start, duration, x, z);
+}
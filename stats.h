@@ -0,0 +1,73 @@
+/*
+stats.h
+
+Performance counters and latency histograms, read through World.stats() and
+World.latencies().  Every thread counts into its own block, so counting is a
+plain add with no locking or atomics; blocks are only summed when they're
+read, and a thread's counts are folded into a shared total when it exits.
+
+Histograms are log-linear, like HDR histograms: each power of two is split
+into 2^HISTOGRAM_SUB_BITS buckets, so a bucket's width is at most 1/8 of the
+values in it, from nanoseconds up to the full 64-bit range.
+*/
+
+#ifndef STATS_INFO_H
+#define STATS_INFO_H
+
+enum {
+    STAT_REGION_LOADS,      // Regions brought into memory, from disk or new
+    STAT_REGION_PREFETCHED, // ... of which were handed over by the prefetcher
+    STAT_REGION_EVICTIONS,  // Regions pushed out to make room
+    STAT_CACHE_HITS,        // Chunk decode cache
+    STAT_CACHE_MISSES,
+    STAT_INFLATED_BYTES,    // Uncompressed bytes out of inf
+    STAT_DEFLATED_BYTES,    // Uncompressed bytes into def
+    STAT_ZLIB_NS,           // Time in inf and def
+    STAT_NBT_PARSE_NS,      // Time in get_tag for whole chunks
+    STAT_NBT_WRITE_NS,      // Time in write_tags
+    STAT_REGION_MOVED_BYTES, // Chunk data shifted by update_region
+    STAT_SUMMARY_SKIPS,     // Chunks find_block ruled out without loading them
+    STAT_COUNT
+};
+
+// Operations timed into histograms, and traced (see trace.c)
+enum {
+    SPAN_CHUNK_LOAD,        // Chunk_init
+    SPAN_CHUNK_SAVE,        // update_region
+    SPAN_REGION_LOAD,       // load_region, when the region isn't in memory
+    SPAN_REGION_SAVE,       // save_region
+    SPAN_COUNT
+};
+
+#define HISTOGRAM_SUB_BITS  3
+#define HISTOGRAM_BUCKETS   ((64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+typedef struct ThreadStats {
+    unsigned long long counters[STAT_COUNT];
+    unsigned long long histograms[SPAN_COUNT][HISTOGRAM_BUCKETS];
+    unsigned long long span_ns[SPAN_COUNT]; // Total time, for the mean
+    int thread_id;                          // Small number, for traces
+    struct ThreadStats *next, *previous;
+} ThreadStats;
+
+extern __thread ThreadStats *thread_stats;
+
+ThreadStats *register_thread_stats( void );
+unsigned long long stats_clock( void );
+void read_stats( ThreadStats *totals );
+void reset_stats( void );
+int histogram_bucket( unsigned long long value );
+unsigned long long bucket_lowest( int bucket );
+unsigned long long bucket_highest( int bucket );
+void end_span( int span, unsigned long long start, int x, int z );
+extern const char *stat_names[STAT_COUNT];
+extern const char *span_names[SPAN_COUNT];
+
+// trace.c
+extern volatile int tracing;
+void trace_span( int span, unsigned long long start, unsigned long long duration, int x, int z );
+
+#define STAT_ADD(counter, amount) \
+    ((thread_stats != NULL ? thread_stats : register_thread_stats())->counters[counter] += (amount))
+
+#endif
@@ -0,0 +1,210 @@
+/*
+summary.c
+
+Block ID summaries, so searches can rule out sections (and whole chunks)
+without inflating them.  For every section of every chunk in a region, a
+256-bit set records the block IDs present, by ID & 255; IDs above 255 share
+bits with lower ones, which only costs a section being looked at needlessly.
+
+A region's summaries are kept up to date by update_region as chunks are
+written to it, and saved by save_region next to the region, in r.x.z.mci.
+That file holds a small header (magic, then the size and modification time
+of the .mca it was written with) followed by the zlib-compressed summaries in
+native byte order; it's a cache rather than part of the world, and is ignored
+if the region file has changed since, or if the region has been written to in
+memory since it was loaded.
+*/
+
+#include <Python.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "minecraft.h"
+#include "log.h"
+
+typedef struct {
+    char magic[4];
+    long long region_size, region_mtime;
+} SummaryHeader;
+
+// Size and modification time (in nanoseconds) of a region file, or -1 each
+static void region_file_version( char *path, int x, int z, long long *size, long long *mtime )
+{
+    char filename[1000];
+    struct stat st;
+
+    sprintf(filename, "%s/region/r.%d.%d.mca", path, x, z);
+    if( stat(filename, &st) != 0 )
+    {
+        *size = *mtime = -1;
+        return;
+    }
+
+    *size = st.st_size;
+    *mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+// Sets the bit for every block ID in a section, compact or not
+void summarize_section( PyObject *section, unsigned char *ids )
+{
+    PyObject *array;
+    int i, size;
+
+    if( is_compact(section) )
+    {
+        unsigned int *palette;
+
+        array = PyDict_GetItem(section, key_palette);
+        palette = (unsigned int *) PyByteArray_AsString(array);
+        size = PyByteArray_Size(array) / sizeof(unsigned int);
+        for( i = 0; i < size; i++ )
+            ids[(palette[i] & 0xFF) >> 3] |= 1 << (palette[i] & 7);
+        return;
+    }
+
+    if( (array = PyDict_GetItem(section, key_blocks)) != NULL )
+    {
+        unsigned char *blocks;
+
+        blocks = (unsigned char *) PyByteArray_AsString(array);
+        for( i = 0; i < 4096; i++ )
+            ids[blocks[i] >> 3] |= 1 << (blocks[i] & 7);
+    }
+}
+
+// Summarizes every section of a chunk dictionary
+void summarize_chunk( ChunkSummary *summary, PyObject *dict )
+{
+    PyObject *level, *sections;
+    int i, size;
+
+    memset(summary, 0, sizeof(ChunkSummary));
+    summary->summarized = true;
+
+    level = PyDict_GetItem(dict, key_level);
+    sections = level == NULL ? NULL : PyDict_GetItem(level, key_sections);
+    size = sections == NULL ? 0 : PyList_Size(sections);
+    for( i = 0; i < size; i++ )
+    {
+        PyObject *section;
+        int y;
+
+        section = PyList_GetItem(sections, i);
+        y = PyInt_AsLong(PyDict_GetItem(section, key_y));
+        if( y < 0 || y > 15 )
+            continue;
+
+        summary->sections |= 1 << y;
+        summarize_section(section, summary->ids[y]);
+    }
+}
+
+/*
+Bit y set for every section y of a summarized chunk that might hold id.
+Chunks that haven't been summarized might hold it anywhere.
+*/
+int candidate_sections( ChunkSummary *summary, int id )
+{
+    int y, sections;
+
+    if( !summary->summarized )
+        return 0xFFFF;
+
+    sections = 0;
+    for( y = 0; y < 16; y++ )
+        if( (summary->sections & (1 << y)) && (summary->ids[y][(id & 0xFF) >> 3] & (1 << (id & 7))) )
+            sections |= 1 << y;
+
+    return sections;
+}
+
+/*
+Summaries for region (x, z) from its .mci file, or all unsummarized if there
+isn't one, or it's out of date.  Returns a malloc'd array of 1024.
+*/
+ChunkSummary *load_summaries( char *path, int x, int z )
+{
+    ChunkSummary *summaries;
+    SummaryHeader header;
+    unsigned char *compressed;
+    char filename[1000];
+    long long size, mtime;
+    struct stat st;
+    FILE *fp;
+    size_t mark;
+
+    summaries = calloc(REGION_CHUNKS, sizeof(ChunkSummary));
+
+    sprintf(filename, "%s/region/r.%d.%d.mci", path, x, z);
+    if( (fp = fopen(filename, "rb")) == NULL )
+        return summaries;
+
+    region_file_version(path, x, z, &size, &mtime);
+    if( fstat(fileno(fp), &st) != 0 || st.st_size <= (off_t) sizeof(SummaryHeader) ||
+        fread(&header, sizeof(SummaryHeader), 1, fp) != 1 || memcmp(header.magic, SUMMARY_MAGIC, 4) != 0 ||
+        header.region_size != size || header.region_mtime != mtime )
+    {
+        log_info("Ignoring out of date summaries in %s", filename);
+        fclose(fp);
+        return summaries;
+    }
+
+    mark = arena_mark();
+    compressed = arena_alloc(st.st_size - sizeof(SummaryHeader));
+    if( fread(compressed, 1, st.st_size - sizeof(SummaryHeader), fp) == st.st_size - sizeof(SummaryHeader) )
+    {
+        unsigned char *inflated;
+        int inflated_size;
+
+        inflated = arena_alloc(CHUNK_BUFFER_SIZE);
+        inflated_size = 0;
+        if( inf(inflated, compressed, st.st_size - sizeof(SummaryHeader), 0, &inflated_size) < 0 ||
+            inflated_size != REGION_CHUNKS * sizeof(ChunkSummary) )
+        {
+            PyErr_Clear();
+            log_warning("Ignoring damaged summaries in %s", filename);
+        }
+        else
+            memcpy(summaries, inflated, inflated_size);
+    }
+
+    arena_release(mark);
+    fclose(fp);
+    return summaries;
+}
+
+// Writes a region's summaries next to it, once the region itself is saved
+int save_summaries( Region *region, char *path )
+{
+    SummaryHeader header;
+    unsigned char *compressed;
+    char filename[1000];
+    int size;
+    FILE *fp;
+    size_t mark;
+
+    memcpy(header.magic, SUMMARY_MAGIC, 4);
+    region_file_version(path, region->x, region->z, &header.region_size, &header.region_mtime);
+
+    sprintf(filename, "%s/region/r.%d.%d.mci", path, region->x, region->z);
+    fp = fopen(filename, "wb");
+    if( fp == NULL )
+    {
+        log_warning("Unable to open %s for writing", filename);
+        return -1;
+    }
+
+    mark = arena_mark();
+    compressed = arena_alloc(CHUNK_BUFFER_SIZE);
+    size = 0;
+    def(compressed, (unsigned char *) region->summaries, REGION_CHUNKS * sizeof(ChunkSummary), 0, &size);
+
+    fwrite(&header, sizeof(SummaryHeader), 1, fp);
+    fwrite(compressed, 1, size, fp);
+    fclose(fp);
+
+    arena_release(mark);
+    return 0;
+}
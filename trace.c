@@ -0,0 +1,158 @@
+/*
+trace.c
+
+Tracing of the operations timed in stats.c.  Each span (a chunk or region
+being loaded or saved) can be written to a Chrome trace file, which loads
+in chrome://tracing or Perfetto, and/or passed to a Python callback.  With
+neither set up, tracing costs end_span a single test of a flag.
+*/
+
+#include <Python.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "stats.h"
+
+volatile int tracing;
+
+static FILE *trace_file;
+static bool trace_first;
+static unsigned long long trace_start;
+static PyObject *trace_callback;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void update_tracing( void )
+{
+    tracing = trace_file != NULL || trace_callback != NULL;
+}
+
+// Finish off the trace file, if there is one, leaving it valid JSON
+static void close_trace_file( void )
+{
+    pthread_mutex_lock(&trace_lock);
+    if( trace_file != NULL )
+    {
+        fprintf(trace_file, "\n]\n");
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+    update_tracing();
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_span( int span, unsigned long long start, unsigned long long duration, int x, int z )
+{
+    PyGILState_STATE state;
+    PyObject *type, *value, *traceback, *result;
+
+    if( trace_file != NULL )
+    {
+        pthread_mutex_lock(&trace_lock);
+        if( trace_file != NULL )
+        {
+            // Complete ("X") events, with times in microseconds
+            fprintf(trace_file, "%s{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d, \"args\": {\"x\": %d, \"z\": %d}}",
+                trace_first ? "" : ",\n", span_names[span], (start - trace_start) / 1000.0, duration / 1000.0,
+                (int) getpid(), thread_stats != NULL ? thread_stats->thread_id : 0, x, z);
+            trace_first = false;
+        }
+        pthread_mutex_unlock(&trace_lock);
+    }
+
+    if( trace_callback == NULL )
+        return;
+
+    // Spans can end on threads without the GIL, and while the operation has
+    // an exception waiting to be raised, neither of which the callback sees
+    state = PyGILState_Ensure();
+    if( trace_callback != NULL )
+    {
+        PyErr_Fetch(&type, &value, &traceback);
+        result = PyObject_CallFunction(trace_callback, "siiKK", span_names[span], x, z, start, duration);
+        if( result == NULL )
+            PyErr_WriteUnraisable(trace_callback);
+        Py_XDECREF(result);
+        PyErr_Restore(type, value, traceback);
+    }
+    PyGILState_Release(state);
+}
+
+/*
+
+Python module functions
+
+*/
+
+// Start writing spans to a Chrome trace file, ending any trace in progress
+PyObject *minecraft_start_trace( PyObject *self, PyObject *args )
+{
+    char *path;
+    FILE *fp;
+
+    if( !PyArg_ParseTuple(args, "s", &path) )
+        return NULL;
+
+    fp = fopen(path, "w");
+    if( fp == NULL )
+    {
+        PyErr_Format(PyExc_Exception, "Unable to open %s for writing", path);
+        return NULL;
+    }
+
+    close_trace_file();
+
+    pthread_mutex_lock(&trace_lock);
+    fprintf(fp, "[\n");
+    trace_file = fp;
+    trace_first = true;
+    trace_start = stats_clock();
+    update_tracing();
+    pthread_mutex_unlock(&trace_lock);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyObject *minecraft_stop_trace( PyObject *self )
+{
+    close_trace_file();
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/*
+Call a function with (operation, x, z, start_ns, duration_ns) as every span
+ends, or stop calling one if passed None
+*/
+PyObject *minecraft_set_trace_callback( PyObject *self, PyObject *args )
+{
+    PyObject *callback, *old;
+
+    if( !PyArg_ParseTuple(args, "O", &callback) )
+        return NULL;
+
+    if( callback != Py_None && !PyCallable_Check(callback) )
+    {
+        PyErr_Format(PyExc_Exception, "Trace callback must be callable or None");
+        return NULL;
+    }
+
+    old = trace_callback;
+    if( callback == Py_None )
+        trace_callback = NULL;
+    else
+    {
+        Py_INCREF(callback);
+        trace_callback = callback;
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    update_tracing();
+    pthread_mutex_unlock(&trace_lock);
+    Py_XDECREF(old);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
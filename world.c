@@ -8,8 +8,48 @@ World object definition and functionality
 #include <structmember.h>
 #include <stdbool.h>
 #include "minecraft.h"
+#include "log.h"
+#include "stats.h"
 #include "tags.h"
 
+// The region (x, z) if it's in memory, counting the regions that are
+static Region *find_region( World *self, int x, int z, int *count )
+{
+    Region *region;
+
+    *count = 0;
+    for( region = self->regions; region != NULL; region = region->next )
+    {
+        if( region->x == x && region->z == z )
+            return region;
+        (*count)++;
+    }
+
+    return NULL;
+}
+
+/*
+Saves and frees a region taken out of the World's list.  Saving can let other
+threads run, so until it's done the region waits among those being saved,
+where load_region and prefetch_region find it rather than the file it's
+halfway through writing.
+*/
+static void evict_region( World *self, Region *region )
+{
+    Region **link;
+
+    region->next = self->saving;
+    self->saving = region;
+    save_region(region, self->path);
+
+    for( link = &self->saving; *link != region; link = &(*link)->next );
+    *link = region->next;
+
+    free(region->buffer);
+    free(region->summaries);
+    free(region);
+}
+
 /*
 Ensures that a region is in memory, or copies the file into memory if it isn't.
 If the region doesn't exist in file form, simply creates a new region in
@@ -21,54 +61,91 @@ being deprecated.
 Region *load_region( World *self, int x, int z )
 {
     FILE *fp;
-    Region *region;
+    Region *region, *loaded, *saving;
     char filename[1000]; // TODO: Dynamic
-    int count;
+    unsigned char *buffer;
+    unsigned long long start;
+    int count, size;
+    bool prefetched;
 
-    // Check to make sure the region isn't already in memory, and count we'll
-    // we're at it (for use below)
-    region = self->regions;
-    count = 0;
-    while( region != NULL )
+    start = stats_clock();
+
+    // Check to make sure the region isn't already in memory
+    if( (region = find_region(self, x, z, &count)) != NULL )
     {
-        if( region->x == x && region->z == z )
-        {
-            printf("Region already in memory!\n");
-            return region;
-        }
-        region = region->next;
-        count++;
+        log_debug("Region (%d, %d) already in memory", x, z);
+        return region;
+    }
+
+    // A region read in the background just needs handing over.  Waiting for
+    // it lets other threads run, and one of them may have loaded the region
+    prefetched = take_prefetched(self, x, z, &buffer, &size);
+    if( (loaded = find_region(self, x, z, &count)) != NULL )
+    {
+        if( prefetched )
+            free(buffer);
+        return loaded;
     }
 
     // Ensure we aren't up against the maximum number of regions in memory - if
     // we are, we'll boot the least-recently used one
     if( count >= MAX_REGIONS )
     {
-        printf("Hit max number of regions in memory, discarding last\n");
+        Region *last;
+
+        log_info("Hit max number of regions in memory, discarding last");
         region = self->regions;
-        count = 0;
-        do {
+        for( count = 1; count < MAX_REGIONS - 1; count++ )
             region = region->next;
-            count++;
-        } while( count < MAX_REGIONS );
-        // Chop off the end
-        unload_region(region->next, self->path);
+        last = region->next;
         region->next = NULL;
+        evict_region(self, last);
+        STAT_ADD(STAT_REGION_EVICTIONS, 1);
     }
 
+    // Likewise while the evicted region was being saved
+    if( (loaded = find_region(self, x, z, &count)) != NULL )
+    {
+        if( prefetched )
+            free(buffer);
+        return loaded;
+    }
+
+    // A region another thread is still saving is copied from memory, as its
+    // file may be half written
+    for( saving = self->saving; saving != NULL; saving = saving->next )
+        if( saving->x == x && saving->z == z )
+            break;
+
     sprintf(filename, "%s/region/r.%d.%d.mca", self->path, x, z);
-    printf("Attempting to load %s\n", filename);
+    log_debug("Attempting to load %s", filename);
 
     region = malloc(sizeof(Region));
 
-    fp = fopen(filename, "rb");
-    if( fp == NULL )
+    STAT_ADD(STAT_REGION_LOADS, 1);
+    if( saving != NULL )
+    {
+        if( prefetched )
+            free(buffer);
+        region->buffer = malloc(saving->buffer_size);
+        memcpy(region->buffer, saving->buffer, saving->buffer_size);
+        region->buffer_size = saving->buffer_size;
+        region->current_size = saving->current_size;
+    }
+    else if( prefetched )
+    {
+        STAT_ADD(STAT_REGION_PREFETCHED, 1);
+        region->buffer = buffer;
+        region->buffer_size = size + REGION_BUFFER_PADDING;
+        region->current_size = size;
+    }
+    else if( (fp = fopen(filename, "rb")) == NULL )
     {
-        printf("Cannot open region file, creating new buffer\n");
+        log_info("Cannot open %s, creating new buffer", filename);
         // Create a new region buffer for the region
         region->buffer = calloc(NEW_REGION_BUFFER_SIZE, 1);
         region->buffer_size = NEW_REGION_BUFFER_SIZE;
-        region->current_size = 0;
+        region->current_size = 8192; // Empty location and timestamp tables
     }
     else
     {
@@ -88,14 +165,77 @@ Region *load_region( World *self, int x, int z )
     }
     region->x = x;
     region->z = z;
+    if( saving != NULL )
+    {
+        // Nor can its .mci be trusted yet
+        region->summaries = NULL;
+        if( saving->summaries != NULL )
+        {
+            region->summaries = malloc(REGION_CHUNKS * sizeof(ChunkSummary));
+            memcpy(region->summaries, saving->summaries, REGION_CHUNKS * sizeof(ChunkSummary));
+        }
+        region->modified = true;
+    }
+    else
+    {
+        region->summaries = self->summarize_regions ? load_summaries(self->path, x, z) : NULL;
+        region->modified = false;
+    }
     region->next = self->regions;
     self->regions = region;
 
     print_region_info(region);
+    read_ahead(self, x, z);
+    end_span(SPAN_REGION_LOAD, start, x, z);
 
     return region;
 }
 
+// Slot in the World's chunk table for the chunk at (x, z)
+int chunk_hash( int x, int z )
+{
+    unsigned int hash;
+
+    hash = ((unsigned int) x << 16) ^ ((unsigned int) z & 0xFFFF);
+    return hash % MAX_CHUNKS;
+}
+
+/*
+Drops the chunk in a slot of the World's chunk table, first writing it back to
+its region if it has changes that would otherwise be lost.
+*/
+static void evict_chunk( World *world, int hash )
+{
+    Chunk *old;
+
+    old = (Chunk *) world->chunks[hash];
+    if( old == NULL )
+        return;
+
+    if( old->modified )
+        update_region(load_region(world, old->x >> 5, old->z >> 5), old);
+
+    world->chunks[hash] = NULL;
+    Py_DECREF(old);
+}
+
+/*
+Places a chunk into the World's chunk table, replacing whatever occupied its
+slot.  The table takes its own reference.
+*/
+void put_chunk( World *world, PyObject *chunk )
+{
+    int hash;
+
+    hash = chunk_hash(((Chunk *) chunk)->x, ((Chunk *) chunk)->z);
+    if( world->chunks[hash] == chunk )
+        return;
+
+    Py_INCREF(chunk);
+    evict_chunk(world, hash);
+    world->chunks[hash] = chunk;
+}
+
 /*
 Helper functionality which looks for a chunk in the simple hash table a World
 contains.  If the location that chunk would be at is empty, or occupied by a 
@@ -107,27 +247,108 @@ PyObject * get_chunk( World *world, int x, int z )
     PyObject *chunk;
     int hash;
 
-    hash = (x << 16 + z) % MAX_CHUNKS;
+    hash = chunk_hash(x, z);
 
     chunk = world->chunks[hash];
     if( chunk == NULL || (((Chunk *) chunk)->x != x || ((Chunk *) chunk)->z != z) )
     {
         PyObject *chunk_args;
 
-        printf("Chunk not found, or wrong chunk, loading\n");
+        log_debug("Chunk (%d, %d) not in the table, loading", x, z);
 
-        Py_XDECREF(chunk);
         chunk_args = Py_BuildValue("Oii", (PyObject *) world, x, z);
         chunk = PyObject_CallObject((PyObject *) &minecraft_ChunkType, chunk_args);
+        Py_DECREF(chunk_args);
 
-        Py_INCREF(chunk); // Table entry reference
-        world->chunks[hash] = chunk;
+        // Chunks that don't exist (or can't be read) leave the table alone
+        if( chunk == NULL )
+            return NULL;
+
+        if( world->compact_chunks )
+            compact_chunk((Chunk *) chunk);
+
+        evict_chunk(world, hash);
+        world->chunks[hash] = chunk; // Table entry reference
     }
 
     Py_INCREF(chunk); 
     return chunk;
 }
 
+// The chunk at (x, z) if it's in the table, as a borrowed reference
+static Chunk *table_chunk( World *world, int x, int z )
+{
+    Chunk *chunk;
+
+    chunk = (Chunk *) world->chunks[chunk_hash(x, z)];
+    return chunk != NULL && chunk->x == x && chunk->z == z ? chunk : NULL;
+}
+
+/*
+A chunk to read from: the one in the table if it's there, or else one loaded
+just for the caller, leaving the table as it was.  Returns a new reference.
+*/
+static PyObject *peek_chunk( World *world, int x, int z )
+{
+    PyObject *chunk, *chunk_args;
+
+    chunk = (PyObject *) table_chunk(world, x, z);
+    if( chunk != NULL )
+    {
+        Py_INCREF(chunk);
+        return chunk;
+    }
+
+    chunk_args = Py_BuildValue("Oii", (PyObject *) world, x, z);
+    chunk = PyObject_CallObject((PyObject *) &minecraft_ChunkType, chunk_args);
+    Py_DECREF(chunk_args);
+
+    return chunk;
+}
+
+/*
+A region's block ID summaries, loading them if the World was set to keep them
+after the region was loaded.  NULL if the World isn't keeping them.  A region
+written to since it was loaded no longer matches its .mci, whatever the file
+says, so it starts out with nothing summarized instead.
+*/
+static ChunkSummary *region_summaries( World *world, Region *region )
+{
+    if( region->summaries == NULL && world->summarize_regions )
+    {
+        if( region->modified )
+            region->summaries = calloc(REGION_CHUNKS, sizeof(ChunkSummary));
+        else
+            region->summaries = load_summaries(world->path, region->x, region->z);
+    }
+
+    return region->summaries;
+}
+
+// Summarize every chunk in a region that hasn't been yet, ready to save
+static void complete_summaries( World *world, Region *region )
+{
+    int i;
+
+    for( i = 0; i < REGION_CHUNKS; i++ )
+    {
+        PyObject *chunk;
+
+        if( region->summaries[i].summarized || swap_endianness(region->buffer + 4 * i, 3) == 0 )
+            continue;
+
+        chunk = peek_chunk(world, region->x * 32 + (i & 31), region->z * 32 + (i >> 5));
+        if( chunk == NULL )
+        {
+            PyErr_Clear();
+            continue;
+        }
+
+        summarize_chunk(&region->summaries[i], ((Chunk *) chunk)->dict);
+        Py_DECREF(chunk);
+    }
+}
+
 /*
 
 Python object-related code
@@ -137,6 +358,9 @@ void World_dealloc( World *self )
 {
     int i;
 
+    stop_prefetcher(self);
+    clear_cache(&self->cache);
+
     for( i = 0; i < MAX_CHUNKS; i++ )
         Py_XDECREF(self->chunks[i]);
     free(self->chunks);
@@ -161,9 +385,7 @@ static int World_init( World *self, PyObject *args, PyObject *kwds )
         PyObject *level, *old_level;
         int size, moved, rc;
         struct stat stbuf;
-
-        src = calloc(10000, 1);
-        dst = calloc(10000, 1);
+        size_t mark;
 
         rc = fstat(fileno(fp), &stbuf); 
         if( rc != 0 )
@@ -175,8 +397,12 @@ static int World_init( World *self, PyObject *args, PyObject *kwds )
         fstat(fileno(fp), &stbuf);
         size = stbuf.st_size;
 
+        mark = arena_mark();
+        src = arena_alloc(size);
+        dst = arena_alloc(CHUNK_BUFFER_SIZE);
+
         fread(src, 1, size, fp);
-        inf(dst, src, size, 1);
+        inf(dst, src, size, 1, NULL);
 
         moved = 0;
         level = get_tag(dst, -1, &moved);
@@ -186,8 +412,7 @@ static int World_init( World *self, PyObject *args, PyObject *kwds )
         self->level = level;
         Py_XDECREF(old_level);
 
-        free(src);
-        free(dst);
+        arena_release(mark);
         fclose(fp);
     }
     else
@@ -198,6 +423,13 @@ static int World_init( World *self, PyObject *args, PyObject *kwds )
 
     self->path = tmp;
     self->regions = NULL;
+    self->saving = NULL;
+    self->prefetcher = NULL;
+    self->read_ahead = true;
+    self->has_last_region = false;
+    self->cache.budget = CHUNK_CACHE_BUDGET;
+    self->compact_chunks = false;
+    self->summarize_regions = false;
 
     // Set up table to store chunks that are in memory
     self->chunks = calloc(sizeof(PyObject *), MAX_CHUNKS);
@@ -205,54 +437,80 @@ static int World_init( World *self, PyObject *args, PyObject *kwds )
     return 0;
 }
 
+/*
+Packed block (see PACK_BLOCK) at a world position, with anything in a chunk
+that doesn't exist reading as 0
+*/
+int world_block_raw( World *world, int x, int y, int z )
+{
+    PyObject *chunk;
+    int packed;
+
+    chunk = get_chunk(world, x >> 4, z >> 4);
+    if( chunk == NULL )
+    {
+        PyErr_Clear();
+        return 0;
+    }
+
+    packed = get_block_raw((Chunk *) chunk, x & 15, y & 255, z & 15);
+    Py_DECREF(chunk);
+
+    return packed;
+}
+
 /*
 Get a block in the world
 */
 static PyObject *World_get_block( World *self, PyObject *args, PyObject *kwds )
 {
-    PyObject *chunk, *block, *block_args;
-    int i, x, y, z;
+    int x, y, z;
 
     if( !PyArg_ParseTuple(args, "iii", &x, &y, &z) )
     {
         PyErr_Format(PyExc_Exception, "Cannot parse parameters");
-
-        Py_INCREF(Py_None);
-        return Py_None;
+        return NULL;
     }
 
-    y = y % 256;
+    return get_block_object(world_block_raw(self, x, y, z));
+}
 
-    chunk = get_chunk(self, x >> 4, z >> 4);
+// Like get_block, but returns the packed int rather than a Block
+static PyObject *World_get_block_raw( World *self, PyObject *args )
+{
+    int x, y, z;
+
+    if( !PyArg_ParseTuple(args, "iii", &x, &y, &z) )
+    {
+        PyErr_Format(PyExc_Exception, "Cannot parse parameters");
+        return NULL;
+    }
 
-    block_args = Py_BuildValue("iii", x % 16, y, z % 16); 
-    block = Chunk_get_block((Chunk *) chunk, block_args);
-    Py_INCREF(block);
-    return block;
+    return PyInt_FromLong(world_block_raw(self, x, y, z));
 }
 
 PyObject *World_put_block( World *self, PyObject *args )
 {
-    PyObject *chunk, *block, *block_args;
+    PyObject *chunk, *block, *block_args, *result;
     int x, y, z;
 
     if( !PyArg_ParseTuple(args, "iiiO", &x, &y, &z, &block) )
     {
         PyErr_Format(PyExc_Exception, "Cannot parse parameters");
-
-        Py_INCREF(Py_None);
-        return Py_None;
+        return NULL;
     }
 
-    y = y % 256;
-
     chunk = get_chunk(self, x >> 4, z >> 4);
+    if( chunk == NULL )
+        return NULL;
 
-    block_args = Py_BuildValue("iiiO", x % 16, y, z % 16, (PyObject *) block); 
-    Chunk_put_block((Chunk *) chunk, block_args);
+    // Chunk_put_block checks the block, and any error goes to the caller
+    block_args = Py_BuildValue("iiiO", x & 15, y & 255, z & 15, (PyObject *) block);
+    result = Chunk_put_block((Chunk *) chunk, block_args);
+    Py_DECREF(block_args);
+    Py_DECREF(chunk);
 
-    Py_INCREF(Py_None);
-    return Py_None;
+    return result;
 }
 
 // TODO: Re-evalute, moving this to a wrapper
@@ -274,6 +532,155 @@ static PyObject *World_load_region( World *self, PyObject *args, PyObject *kwds
     return Py_None;
 }
 
+/*
+Performance counters, summed over every thread, as a dictionary.  Passing
+reset=True zeroes them (and the latency histograms) after they're read.
+*/
+static PyObject *World_stats( World *self, PyObject *args, PyObject *kwds )
+{
+    static char *kwlist[] = {"reset", NULL};
+    ThreadStats totals;
+    PyObject *stats, *reset, *value;
+    int i;
+
+    reset = Py_False;
+    if( !PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &reset) )
+        return NULL;
+
+    read_stats(&totals);
+    if( PyObject_IsTrue(reset) )
+        reset_stats();
+
+    stats = PyDict_New();
+    for( i = 0; i < STAT_COUNT; i++ )
+    {
+        value = PyLong_FromUnsignedLongLong(totals.counters[i]);
+        PyDict_SetItemString(stats, stat_names[i], value);
+        Py_DECREF(value);
+    }
+
+    // What the cache is holding right now, rather than a running count
+    value = PyInt_FromLong(self->cache.bytes);
+    PyDict_SetItemString(stats, "cache_bytes", value);
+    Py_DECREF(value);
+
+    return stats;
+}
+
+// Value below which a fraction of a histogram's count falls
+static unsigned long long histogram_percentile( unsigned long long *histogram, unsigned long long count, double fraction )
+{
+    unsigned long long seen, rank;
+    int i;
+
+    rank = (unsigned long long) (count * fraction);
+    if( rank >= count )
+        rank = count - 1;
+
+    seen = 0;
+    for( i = 0; i < HISTOGRAM_BUCKETS; i++ )
+    {
+        seen += histogram[i];
+        if( seen > rank )
+            return bucket_highest(i);
+    }
+    return 0;
+}
+
+/*
+Latency histograms for chunk and region loads and saves, summed over every
+thread.  Returns a dictionary of operation name to a dictionary of count,
+mean, min, max and percentiles (all in nanoseconds, and accurate to the 1/8
+width of the bucket they fall in), plus the non-empty buckets as (lowest,
+highest, count) tuples.  Passing reset=True zeroes them (and the counters).
+*/
+static PyObject *World_latencies( World *self, PyObject *args, PyObject *kwds )
+{
+    static char *kwlist[] = {"reset", NULL};
+    static const double percentiles[] = {0.5, 0.9, 0.99, 0.999};
+    static const char *percentile_names[] = {"p50", "p90", "p99", "p999"};
+    ThreadStats totals;
+    PyObject *latencies, *reset;
+    int span, i;
+
+    reset = Py_False;
+    if( !PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &reset) )
+        return NULL;
+
+    read_stats(&totals);
+    if( PyObject_IsTrue(reset) )
+        reset_stats();
+
+    latencies = PyDict_New();
+    for( span = 0; span < SPAN_COUNT; span++ )
+    {
+        unsigned long long *histogram, count, lowest, highest;
+        PyObject *summary, *buckets, *value;
+
+        histogram = totals.histograms[span];
+        count = lowest = highest = 0;
+        buckets = PyList_New(0);
+        for( i = 0; i < HISTOGRAM_BUCKETS; i++ )
+        {
+            if( histogram[i] == 0 )
+                continue;
+
+            if( count == 0 )
+                lowest = bucket_lowest(i);
+            highest = bucket_highest(i);
+            count += histogram[i];
+
+            value = Py_BuildValue("KKK", bucket_lowest(i), bucket_highest(i), histogram[i]);
+            PyList_Append(buckets, value);
+            Py_DECREF(value);
+        }
+
+        summary = PyDict_New();
+        value = PyLong_FromUnsignedLongLong(count);
+        PyDict_SetItemString(summary, "count", value);
+        Py_DECREF(value);
+        value = PyFloat_FromDouble(count != 0 ? (double) totals.span_ns[span] / count : 0.0);
+        PyDict_SetItemString(summary, "mean", value);
+        Py_DECREF(value);
+        value = PyLong_FromUnsignedLongLong(lowest);
+        PyDict_SetItemString(summary, "min", value);
+        Py_DECREF(value);
+        value = PyLong_FromUnsignedLongLong(highest);
+        PyDict_SetItemString(summary, "max", value);
+        Py_DECREF(value);
+        for( i = 0; i < 4; i++ )
+        {
+            value = PyLong_FromUnsignedLongLong(count != 0 ? histogram_percentile(histogram, count, percentiles[i]) : 0);
+            PyDict_SetItemString(summary, percentile_names[i], value);
+            Py_DECREF(value);
+        }
+        PyDict_SetItemString(summary, "buckets", buckets);
+        Py_DECREF(buckets);
+
+        PyDict_SetItemString(latencies, span_names[span], summary);
+        Py_DECREF(summary);
+    }
+
+    return latencies;
+}
+
+/*
+Start reading a region file in the background, so that a later load_region
+doesn't have to wait for it.  Returns whether the region was queued.
+*/
+static PyObject *World_prefetch_region( World *self, PyObject *args )
+{
+    int region_x, region_z;
+
+    if( !PyArg_ParseTuple(args, "ii", &region_x, &region_z) )
+    {
+        PyErr_Format(PyExc_Exception, "Cannot parse prefetch_region parameters");
+        return NULL;
+    }
+
+    return PyBool_FromLong(prefetch_region(self, region_x, region_z));
+}
+
 static PyObject *World_save_region( World *self, PyObject *args, PyObject *kwds )
 {
     Region *region;
@@ -296,7 +703,7 @@ static PyObject *World_save_region( World *self, PyObject *args, PyObject *kwds
     }
 
     if( region == NULL)
-        printf("Region (%d, %d) not loaded!\n", region_x, region_z);
+        log_warning("Region (%d, %d) not loaded", region_x, region_z);
     else
     {
         int i;
@@ -310,11 +717,14 @@ static PyObject *World_save_region( World *self, PyObject *args, PyObject *kwds
                 continue;
             else if( chunk->x >> 5 == region_x && chunk->z >> 5 == region_z )
             {
-                printf("Chunk %d,%d saved during region save\n", chunk->x, chunk->z);
+                log_debug("Chunk %d,%d saved during region save", chunk->x, chunk->z);
                 update_region(region, chunk);
             }
         }
 
+        if( region_summaries(self, region) != NULL )
+            complete_summaries(self, region);
+
         save_region(region, self->path); 
     }
 
@@ -324,7 +734,6 @@ static PyObject *World_save_region( World *self, PyObject *args, PyObject *kwds
 
 static PyObject *World_load_chunk( World *self, PyObject *args )
 {
-    PyObject *chunk, *chunk_args;
     int x, z;
 
     if( !PyArg_ParseTuple(args, "ii", &x, &z) )
@@ -335,11 +744,396 @@ static PyObject *World_load_chunk( World *self, PyObject *args )
         return Py_None;
     }
 
-    chunk_args = Py_BuildValue("Oii", (PyObject *) self, x, z);
-    chunk = PyObject_CallObject((PyObject *) &minecraft_ChunkType, chunk_args);
-    Py_DECREF(chunk_args);
+    // Share the chunk in the table, so a chunk loaded again isn't decoded again
+    // and edits made through it are seen by the World
+    return get_chunk(self, x, z);
+}
 
-    return chunk;
+// Compact every chunk in the table (see Chunk.compact), returning the bytes saved
+static PyObject *World_compact( World *self )
+{
+    int i, saved;
+
+    saved = 0;
+    for( i = 0; i < MAX_CHUNKS; i++ )
+        if( self->chunks[i] != NULL )
+            saved += compact_chunk((Chunk *) self->chunks[i]);
+
+    return PyInt_FromLong(saved);
+}
+
+// Append the world positions of every block with ID id in a section of a chunk
+static void find_in_section( Chunk *chunk, int y, int id, PyObject *found, int limit )
+{
+    PyObject *section, *array;
+    unsigned char mask[4096];
+    int i;
+
+    section = find_section(chunk, y);
+    if( section == NULL )
+        return;
+
+    if( is_compact(section) )
+    {
+        // The palette rules most sections out without looking at any blocks
+        if( !palette_holds(section, id) )
+            return;
+        for( i = 0; i < 4096; i++ )
+            mask[i] = (compact_block_raw(section, i) & 0xFFF) == id ? 0xFF : 0x00;
+    }
+    else
+    {
+        unsigned char *add;
+
+        if( (array = PyDict_GetItem(section, key_blocks)) == NULL )
+            return;
+        add = PyDict_GetItem(section, key_add) != NULL ? (unsigned char *) PyByteArray_AsString(PyDict_GetItem(section, key_add)) : NULL;
+        if( match_ids((unsigned char *) PyByteArray_AsString(array), add, id, mask, 4096) == 0 )
+            return;
+    }
+
+    for( i = 0; i < 4096 && (limit <= 0 || PyList_Size(found) < limit); i++ )
+    {
+        PyObject *position;
+
+        if( mask[i] == 0 )
+            continue;
+
+        position = Py_BuildValue("iii", chunk->x * 16 + (i & 15), y * 16 + (i >> 8), chunk->z * 16 + ((i >> 4) & 15));
+        PyList_Append(found, position);
+        Py_DECREF(position);
+    }
+}
+
+/*
+Find the blocks with an ID in a region, as a list of (x, y, z) world
+positions, stopping after limit of them if limit is given.  With
+summarize_regions set, the region's block ID summaries rule out chunks and
+sections that can't hold the ID, so they're never inflated.
+*/
+static PyObject *World_find_block( World *self, PyObject *args, PyObject *kwds )
+{
+    static char *keywords[] = {"id", "region_x", "region_z", "limit", NULL};
+    Region *region;
+    ChunkSummary *summaries;
+    PyObject *found;
+    int id, region_x, region_z, limit, i;
+
+    limit = 0;
+    if( !PyArg_ParseTupleAndKeywords(args, kwds, "iii|i", keywords, &id, &region_x, &region_z, &limit) )
+        return NULL;
+
+    if( id < 0 || id > 4095 )
+    {
+        PyErr_Format(PyExc_Exception, "Block ID must be 0-4095");
+        return NULL;
+    }
+
+    region = load_region(self, region_x, region_z);
+    summaries = region_summaries(self, region);
+
+    found = PyList_New(0);
+    for( i = 0; i < REGION_CHUNKS && (limit <= 0 || PyList_Size(found) < limit); i++ )
+    {
+        PyObject *chunk;
+        Chunk *held;
+        int cx, cz, sections, y;
+
+        if( swap_endianness(region->buffer + 4 * i, 3) == 0 )
+            continue;
+
+        // A chunk changed in memory may hold what its summary says it doesn't
+        cx = region_x * 32 + (i & 31);
+        cz = region_z * 32 + (i >> 5);
+        held = table_chunk(self, cx, cz);
+        sections = summaries != NULL && (held == NULL || !held->modified) ? candidate_sections(&summaries[i], id) : 0xFFFF;
+        if( sections == 0 )
+        {
+            STAT_ADD(STAT_SUMMARY_SKIPS, 1);
+            continue;
+        }
+
+        chunk = peek_chunk(self, cx, cz);
+        if( chunk == NULL )
+        {
+            PyErr_Clear();
+            continue;
+        }
+
+        // Now that it's been loaded anyway, it can be ruled out next time
+        if( summaries != NULL && !summaries[i].summarized && !((Chunk *) chunk)->modified )
+            summarize_chunk(&summaries[i], ((Chunk *) chunk)->dict);
+
+        for( y = 0; y < 16 && (limit <= 0 || PyList_Size(found) < limit); y++ )
+            if( sections & (1 << y) )
+                find_in_section((Chunk *) chunk, y, id, found, limit);
+        Py_DECREF(chunk);
+    }
+
+    return found;
+}
+
+/*
+Chunk source used by block light propagation.  Every chunk the fill reaches
+is kept alive in held until the pass is over, since loading further chunks
+can push earlier ones out of the World's chunk table.
+*/
+typedef struct {
+    World *world;
+    PyObject *held;
+} LightContext;
+
+static int light_context_load( void *context, int cx, int cz, ChunkArrays *arrays )
+{
+    LightContext *light;
+    PyObject *chunk;
+
+    light = (LightContext *) context;
+    chunk = get_chunk(light->world, cx, cz);
+    if( chunk == NULL )
+    {
+        PyErr_Clear(); // Ungenerated chunks simply stop the light
+        return -1;
+    }
+
+    PyList_Append(light->held, chunk);
+    Py_DECREF(chunk);
+
+    if( get_chunk_arrays((Chunk *) chunk, arrays) != 0 )
+    {
+        PyErr_Clear();
+        return -1;
+    }
+
+    return 0;
+}
+
+static int light_context_add_section( void *context, int cx, int cz, int y, ChunkArrays *arrays )
+{
+    LightContext *light;
+    int i, size;
+
+    light = (LightContext *) context;
+    size = PyList_Size(light->held);
+    for( i = 0; i < size; i++ )
+    {
+        Chunk *chunk;
+
+        chunk = (Chunk *) PyList_GetItem(light->held, i);
+        if( chunk->x == cx && chunk->z == cz )
+        {
+            create_section(chunk, y);
+            return get_chunk_arrays(chunk, arrays);
+        }
+    }
+
+    return -1;
+}
+
+/*
+Update block light after the blocks at a set of world positions changed,
+given as a sequence of (x, y, z) tuples.  Light is added and removed across
+chunk borders, with all positions handled in a single pass.
+*/
+static PyObject *World_update_block_light( World *self, PyObject *args )
+{
+    PyObject *positions, *sequence;
+    ChunkSource source;
+    LightContext context;
+    int i, count, *coords;
+
+    if( !PyArg_ParseTuple(args, "O", &positions) )
+    {
+        PyErr_Format(PyExc_Exception, "Cannot parse parameters");
+        return NULL;
+    }
+
+    sequence = PySequence_Fast(positions, "Positions must be a sequence of (x, y, z) tuples");
+    if( sequence == NULL )
+        return NULL;
+
+    count = PySequence_Fast_GET_SIZE(sequence);
+    coords = malloc(sizeof(int) * 3 * (count > 0 ? count : 1));
+    for( i = 0; i < count; i++ )
+    {
+        if( !PyArg_ParseTuple(PySequence_Fast_GET_ITEM(sequence, i), "iii", &coords[i * 3], &coords[i * 3 + 1], &coords[i * 3 + 2]) )
+        {
+            free(coords);
+            Py_DECREF(sequence);
+            return NULL;
+        }
+    }
+    Py_DECREF(sequence);
+
+    context.world = self;
+    context.held = PyList_New(0);
+    source.context = &context;
+    source.load = light_context_load;
+    source.add_section = light_context_add_section;
+
+    init_light_tables();
+    light_blocks(&source, coords, count);
+    free(coords);
+
+    // Anything the pass pushed out of the chunk table would otherwise lose
+    // its new light, so write it back to its region
+    count = PyList_Size(context.held);
+    for( i = 0; i < count; i++ )
+    {
+        Chunk *chunk;
+
+        chunk = (Chunk *) PyList_GetItem(context.held, i);
+        if( self->chunks[chunk_hash(chunk->x, chunk->z)] != (PyObject *) chunk )
+            update_region(load_region(self, chunk->x >> 5, chunk->z >> 5), chunk);
+        else
+            chunk->modified = true;
+    }
+    Py_DECREF(context.held);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/*
+Recalculate heightmaps, skylight and block light for every chunk in a region,
+spread over the given number of threads, and write the chunks back to the
+region.  Light is carried across chunk borders within the region.
+*/
+static PyObject *World_relight_region( World *self, PyObject *args, PyObject *kwds )
+{
+    static char *kwlist[] = {"region_x", "region_z", "threads", NULL};
+    Region *region;
+    PyObject **chunks;
+    ChunkArrays *arrays, **present;
+    int (*heightmaps)[256];
+    int region_x, region_z, threads, i, j;
+
+    threads = 1;
+    if( !PyArg_ParseTupleAndKeywords(args, kwds, "ii|i", kwlist, &region_x, &region_z, &threads) )
+        return NULL;
+
+    if( threads < 1 )
+    {
+        PyErr_Format(PyExc_Exception, "Need at least one thread");
+        return NULL;
+    }
+
+    region = load_region(self, region_x, region_z);
+    chunks = calloc(1024, sizeof(PyObject *));
+    present = calloc(1024, sizeof(ChunkArrays *));
+    arrays = malloc(sizeof(ChunkArrays) * 1024);
+    heightmaps = malloc(sizeof(int) * 256 * 1024);
+
+    for( i = 0; i < 1024; i++ )
+    {
+        PyObject *chunk;
+        int x, z, top;
+
+        x = region_x * 32 + (i & 31);
+        z = region_z * 32 + (i >> 5);
+
+        // Chunks already in memory may have changes the region doesn't
+        chunk = self->chunks[chunk_hash(x, z)];
+        if( chunk != NULL && ((Chunk *) chunk)->x == x && ((Chunk *) chunk)->z == z )
+            Py_INCREF(chunk);
+        else if( swap_endianness(region->buffer + i * 4, 3) != 0 )
+        {
+            PyObject *chunk_args;
+
+            chunk_args = Py_BuildValue("Oii", (PyObject *) self, x, z);
+            chunk = PyObject_CallObject((PyObject *) &minecraft_ChunkType, chunk_args);
+            Py_DECREF(chunk_args);
+            if( chunk == NULL )
+            {
+                PyErr_Clear();
+                continue;
+            }
+        }
+        else
+            continue;
+
+        if( get_chunk_arrays((Chunk *) chunk, &arrays[i]) != 0 )
+        {
+            PyErr_Clear();
+            Py_DECREF(chunk);
+            continue;
+        }
+
+        // Light can only be stored in sections, so fill in any gaps, plus
+        // one section of air above the top for light escaping upwards
+        for( top = 15; top >= 0 && arrays[i].blocks[top] == NULL; top-- );
+        for( j = 0; j <= top + 1 && j < 16; j++ )
+            if( arrays[i].blocks[j] == NULL )
+                create_section((Chunk *) chunk, j);
+        get_chunk_arrays((Chunk *) chunk, &arrays[i]);
+
+        chunks[i] = chunk;
+        present[i] = &arrays[i];
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    light_region(present, heightmaps, threads);
+    Py_END_ALLOW_THREADS
+
+    for( i = 0; i < 1024; i++ )
+    {
+        PyObject *level, *heightmap_list;
+        Chunk *chunk;
+
+        if( chunks[i] == NULL )
+            continue;
+
+        chunk = (Chunk *) chunks[i];
+        heightmap_list = PyList_New(256);
+        for( j = 0; j < 256; j++ )
+            PyList_SET_ITEM(heightmap_list, j, PyInt_FromLong(heightmaps[i][j]));
+        level = PyDict_GetItem(chunk->dict, key_level);
+        PyDict_SetItem(level, key_height_map, heightmap_list);
+        Py_DECREF(heightmap_list);
+
+        chunk->dirty = false;
+        memset(chunk->dirty_columns, 0, sizeof(chunk->dirty_columns));
+
+        update_region(region, chunk);
+        Py_DECREF(chunk);
+    }
+
+    free(heightmaps);
+    free(arrays);
+    free(present);
+    free(chunks);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Iterate over the (x, z) coordinates of every region with a file
+static PyObject *World_iter_regions( World *self )
+{
+    return create_world_iterator(self, false, NULL);
+}
+
+/*
+Iterate over the (x, z) coordinates of every chunk that exists, optionally
+only those within bbox, given as chunk coordinates (x1, z1, x2, z2)
+*/
+static PyObject *World_iter_chunks( World *self, PyObject *args, PyObject *kwds )
+{
+    static char *kwlist[] = {"bbox", NULL};
+    PyObject *bbox_arg;
+    int bbox[4];
+
+    bbox_arg = Py_None;
+    if( !PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &bbox_arg) )
+        return NULL;
+
+    if( bbox_arg == Py_None )
+        return create_world_iterator(self, true, NULL);
+
+    if( !PyArg_ParseTuple(bbox_arg, "iiii", &bbox[0], &bbox[1], &bbox[2], &bbox[3]) )
+        return NULL;
+
+    return create_world_iterator(self, true, bbox);
 }
 
 // Right now, just save out level.dat
@@ -349,11 +1143,14 @@ static PyObject *World_save( World *self )
     char filename[1000];
     unsigned char *compressed, *uncompressed;
     int size, deflated_size;
+    size_t mark;
 
-    uncompressed = calloc(10000, 1);
-    compressed = calloc(5000, 1);
+    mark = arena_mark();
+    uncompressed = arena_alloc(CHUNK_BUFFER_SIZE);
+    compressed = arena_alloc(CHUNK_BUFFER_SIZE);
     size = write_tags(uncompressed, self->level, leveldat_tags);
-    dump_buffer(uncompressed, 480);
+    if( LOG_ENABLED(LOG_DEBUG) )
+        dump_buffer(uncompressed, 480);
 
     deflated_size = 0;
     def(compressed, uncompressed, size, 1, &deflated_size);
@@ -362,13 +1159,12 @@ static PyObject *World_save( World *self )
     fp = fopen(filename, "wb");
     if( fp != NULL )
     {
-        fwrite(compressed, size, 1, fp);
+        fwrite(compressed, deflated_size, 1, fp);
 
         fclose(fp);
     }
 
-    free(compressed);
-    free(uncompressed);
+    arena_release(mark);
 
     Py_INCREF(Py_None);
     return Py_None;
@@ -377,15 +1173,34 @@ static PyObject *World_save( World *self )
 static PyMemberDef World_members[] = {
     {"path", T_STRING, offsetof(World, path), 0, "Path to the base minecraft world directory"},
     {"level", T_OBJECT, offsetof(World, level), 0, "Dictionary containing level.dat attributes"},
+    {"cache_budget", T_INT, offsetof(World, cache.budget), 0, "Bytes of decompressed chunks to keep cached"},
+    {"read_ahead", T_BOOL, offsetof(World, read_ahead), 0, "Whether to prefetch the next region when regions are loaded in a line"},
+    {"compact_chunks", T_BOOL, offsetof(World, compact_chunks), 0, "Whether to compact chunks as they're loaded, keeping sections with few distinct blocks as a palette"},
+    {"summarize_regions", T_BOOL, offsetof(World, summarize_regions), 0, "Whether to keep block ID summaries of regions (saved as r.x.z.mci) so find_block can skip chunks and sections"},
     {NULL}
 };
 
 static PyMethodDef World_methods[] = {
     {"save", (PyCFunction) World_save, METH_NOARGS, "Save the world! (out to file, anyway)"},
     {"load_chunk", (PyCFunction) World_load_chunk, METH_VARARGS, "Load a chunk."},
+    {"compact", (PyCFunction) World_compact, METH_NOARGS, "Compact every chunk in memory, returning the bytes saved."},
+    {"find_block", (PyCFunction) World_find_block, METH_VARARGS | METH_KEYWORDS, "Find the (x, y, z) positions of blocks with an ID in a region, optionally stopping after limit of them."},
     {"get_block", (PyCFunction) World_get_block, METH_VARARGS, "Get the block at a given location."},
+    {"get_block_raw", (PyCFunction) World_get_block_raw, METH_VARARGS, "Get the block at a given location, packed as id | data << 12 | blocklight << 16 | skylight << 20."},
     {"put_block", (PyCFunction) World_put_block, METH_VARARGS, "Put a block at a given spot."},
+    {"update_block_light", (PyCFunction) World_update_block_light, METH_VARARGS, "Update block light around a sequence of changed (x, y, z) positions."},
+    {"get_blocks", (PyCFunction) World_get_blocks, METH_VARARGS, "Get many blocks, given a buffer of int32 (x, y, z) triples, as a buffer of packed uint32."},
+    {"put_blocks", (PyCFunction) World_put_blocks, METH_VARARGS, "Put many blocks, given a buffer of int32 (x, y, z) triples and one of packed uint32."},
+    {"fill", (PyCFunction) World_fill, METH_VARARGS, "Fill a box with a block ID (and data value)."},
+    {"replace", (PyCFunction) World_replace, METH_VARARGS, "Replace one block ID with another within a box."},
+    {"copy", (PyCFunction) World_copy, METH_VARARGS, "Copy a box of blocks to another position."},
+    {"relight_region", (PyCFunction) World_relight_region, METH_VARARGS | METH_KEYWORDS, "Recalculate heightmaps and lighting for a whole region."},
+    {"iter_regions", (PyCFunction) World_iter_regions, METH_NOARGS, "Iterate over the (x, z) coordinates of the regions in the world."},
+    {"iter_chunks", (PyCFunction) World_iter_chunks, METH_VARARGS | METH_KEYWORDS, "Iterate over the (x, z) coordinates of the chunks in the world, optionally within a chunk bounding box (x1, z1, x2, z2)."},
     {"load_region", (PyCFunction) World_load_region, METH_VARARGS, "Load a region."},
+    {"stats", (PyCFunction) World_stats, METH_VARARGS | METH_KEYWORDS, "Get performance counters (summed over all threads) as a dictionary, optionally resetting them."},
+    {"latencies", (PyCFunction) World_latencies, METH_VARARGS | METH_KEYWORDS, "Get latency histograms for chunk and region loads and saves, optionally resetting them (and the counters)."},
+    {"prefetch_region", (PyCFunction) World_prefetch_region, METH_VARARGS, "Start reading a region in the background."},
     {"save_region", (PyCFunction) World_save_region, METH_VARARGS, "Save a region, assuming it has been modified and is in memory"},
     {NULL}
 };